@@ -14,7 +14,7 @@
 // Rule: Any relocated key must be placed at a later index, but no further than the end of its virtual bucket (neighborhood).
 // Rule: Once a key/value has been marked with a sentinel, it can never be overwritten.
 // Rule: Values are initially bitmarked if they came from a table migration.
-// Rule: Table size must be a power of two.
+// Rule: Table size is a multiple of Table::MIN_SIZE. Hashes are mapped onto it by multiply-shift range reduction.
 
 // Requirement: Contiguous placement of keys and values.
 // Requirement: Low memory overhead. Should minimize the use of pointers, auxiliary data structures, etc.
@@ -28,13 +28,18 @@
 #ifndef HASH_MAP_HPP
 #define HASH_MAP_HPP
 
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <chrono>
 #include <cstddef>
 #include <filesystem>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <thread>
 #include <utility>
+#include <vector>
 
 // Fast hashing library.
 #include "xxhash.hpp"
@@ -44,6 +49,12 @@
 #include "marking.hpp"
 // Global definitions.
 #include "define.hpp"
+// NUMA topology, used to keep migration node-local.
+#include "numa.hpp"
+// Preallocated table storage.
+#include "tablePool.hpp"
+// Runtime statistics policies.
+#include "mapStats.hpp"
 
 // mmap.
 #include <sys/mman.h>
@@ -58,9 +69,225 @@
 // These are used to enable and disable different variants of our design.
 #define RESIZE
 
-inline const size_t REPROBE_LIMIT = 10;
+// Slots in each table's overflow stash, for keys whose probe sequence reached the probe limit.
+inline const size_t STASH_SIZE = 64;
+// How often the background preallocator checks the load of the top table.
+inline const std::chrono::microseconds PREALLOC_INTERVAL(100);
+
+// Migration work is split into chunks of slots.
+// Chunks are sized so every thread gets several, within these bounds.
+inline const size_t MIN_COPY_WORK = 1024;
+inline const size_t MAX_COPY_WORK = 1 << 16;
+inline const size_t CHUNKS_PER_THREAD = 8;
+// Threads claim several chunks at once, adapting the count so each claim takes about this long.
+inline const std::chrono::nanoseconds COPY_CLAIM_TARGET(50000);
+inline const size_t MAX_COPY_CLAIM = 64;
+// Chunks are handed out per NUMA node. Nodes beyond this share stripes.
+inline const size_t MAX_COPY_STRIPES = 8;
+// How long idle migrator threads wait before checking for a migration on their own.
+inline const std::chrono::milliseconds MIGRATOR_IDLE(1);
+// A copy budget that lets an operation help until the migration is complete.
+inline const size_t UNLIMITED_COPY_BUDGET = SIZE_MAX;
+// How many slots ahead bulk migration prefetches the destination of a pair.
+inline const size_t COPY_PREFETCH_DISTANCE = 8;
+
+// Identifies a formatted table header.
+inline const uint64_t TABLE_MAGIC = 0x4c42544646494c43; // "CLIFFTBL"
+// KV pairs start on a page boundary after the table header.
+inline const size_t TABLE_ALIGN = 4096;
+
+// The current time on the steady clock, in nanoseconds.
+inline int64_t steadyNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters describing table migrations, in the units reported to users.
+struct MigrationMetrics
+{
+    // Number of completed migrations.
+    size_t migrations;
+    // Bytes of old tables migrated.
+    size_t bytes;
+    // Wall time from the start to the end of each migration, summed over migrations.
+    double migrationSeconds;
+    // Time foreground operations spent helping to migrate, summed over threads.
+    double helperSeconds;
+    // Time dedicated migrator threads spent migrating, summed over threads.
+    double migratorSeconds;
+    // Bytes of old tables given back before their migration finished.
+    size_t releasedBytes;
+
+    // Migration bandwidth, in GB/s.
+    double gigabytesPerSecond() const
+    {
+        return migrationSeconds > 0 ? bytes / migrationSeconds / 1e9 : 0;
+    }
+};
+
+// The layout of one table, as found by ConcurrentHashMap::inspect().
+struct TableReport
+{
+    // The number of longest clusters kept.
+    static const size_t TOP_CLUSTERS = 5;
+    // Probe lengths are bucketed by powers of two: bucket b holds lengths in [2^b, 2^(b+1)).
+    static const size_t PROBE_BUCKETS = 64;
+
+    size_t capacity = 0;
+    size_t stashSize = 0;
+    // Slots holding a key, including deleted and migrated keys.
+    size_t keys = 0;
+    // Slots holding a value.
+    size_t live = 0;
+    // Slots whose value was deleted.
+    size_t tombstones = 0;
+    // Slots retired by a migration.
+    size_t migrated = 0;
+    // Slots holding a value frozen for a migration but not yet retired.
+    size_t frozen = 0;
+    // Slots of migrated chunks whose memory was released.
+    size_t released = 0;
+    // Stash slots holding a key.
+    size_t stashKeys = 0;
+    // The number of chunks in each ChunkState.
+    size_t activeChunks = 0;
+    size_t frozenChunks = 0;
+    size_t doneChunks = 0;
+    // Distance from each key's home slot to the slot it is in, outside the stash.
+    size_t totalDisplacement = 0;
+    size_t maxDisplacement = 0;
+    // The slots an unsuccessful lookup probes, summed over every home slot.
+    size_t totalMissProbes = 0;
+    // Successful lookups by the number of slots they probe.
+    size_t probes[PROBE_BUCKETS] = {};
+    // The longest runs of slots holding keys, as (length, first slot), longest first.
+    std::vector<std::pair<size_t, size_t>> clusters;
+
+    // Fold the report of another part of the same table into this one.
+    void merge(const TableReport &other)
+    {
+        keys += other.keys;
+        live += other.live;
+        tombstones += other.tombstones;
+        migrated += other.migrated;
+        frozen += other.frozen;
+        released += other.released;
+        stashKeys += other.stashKeys;
+        totalDisplacement += other.totalDisplacement;
+        maxDisplacement = std::max(maxDisplacement, other.maxDisplacement);
+        totalMissProbes += other.totalMissProbes;
+        for (size_t b = 0; b < PROBE_BUCKETS; b++)
+        {
+            probes[b] += other.probes[b];
+        }
+        for (auto &cluster : other.clusters)
+        {
+            addCluster(cluster.first, cluster.second);
+        }
+    }
+    // Account for a run of slots holding keys.
+    void addCluster(size_t length, size_t first)
+    {
+        clusters.emplace_back(length, first);
+        std::sort(clusters.begin(), clusters.end(), std::greater<std::pair<size_t, size_t>>());
+        if (clusters.size() > TOP_CLUSTERS)
+        {
+            clusters.pop_back();
+        }
+    }
+    void print(std::ostream &stream, const std::string &label) const
+    {
+        size_t placed = keys - stashKeys;
+        stream << label << ": capacity = " << capacity << " + " << stashSize << " stash"
+               << ", occupancy = " << (capacity > 0 ? 100.0 * placed / capacity : 0) << "%"
+               << ", stash used = " << stashKeys << std::endl
+               << "  keys = " << keys << ", live = " << live << ", deleted = " << tombstones
+               << " (" << (keys > 0 ? 100.0 * tombstones / keys : 0) << "% tombstones)" << std::endl
+               << "  migration: " << migrated << " slots retired, " << frozen << " frozen, " << released << " released; chunks "
+               << activeChunks << " active, " << frozenChunks << " frozen, " << doneChunks << " done" << std::endl
+               << "  displacement: mean = " << (placed > 0 ? (double)totalDisplacement / placed : 0)
+               << ", max = " << maxDisplacement
+               << "; unsuccessful lookup probes: mean = " << (capacity > 0 ? (double)totalMissProbes / capacity : 0) << std::endl
+               << "  longest clusters:";
+        for (auto &cluster : clusters)
+        {
+            stream << " " << cluster.first << " at " << cluster.second;
+        }
+        stream << std::endl
+               << "  successful lookup probes:";
+        for (size_t b = 0; b < PROBE_BUCKETS; b++)
+        {
+            if (probes[b] > 0)
+            {
+                stream << " [" << ((size_t)1 << b) << ", " << ((size_t)2 << b) << ") = " << probes[b];
+            }
+        }
+        stream << std::endl;
+    }
+};
+
+// Per-map settings.
+struct MapOptions
+{
+    // Pool file or device-DAX region backing every table of the map.
+    // If empty, each table gets its own file instead.
+    std::string poolPath = "";
+    // Size of a newly created pool, in bytes.
+    size_t poolSize = (size_t)1 << 30;
+    // Fraction of the top table's slots holding keys at which a background thread prepares the next table.
+    // Must be below loadFactor, which counts the same slots, so the table is ready before the resize.
+    // Zero disables the background thread.
+    double preallocThreshold = 0;
+    // Number of dedicated migrator threads.
+    // With migrators, foreground operations only help to migrate when the migrators fall behind.
+    size_t migrators = 0;
+    // Fraction of a table's slots holding keys at which the table is replaced by a larger one.
+    double loadFactor = 0.7;
+    // The most slots a key's probe sequence may cover. Keys that find no room within it go to the table's stash.
+    size_t probeLimit = 64;
+    // Factor by which each new table is larger than the one it replaces.
+    double growthFactor = 2;
+    // Whether to give the memory of migrated chunks back to the file system as a migration proceeds.
+    bool releaseChunks = true;
+    // Threads that finish the migrations a crash interrupted, in the background after recovery.
+    // Zero leaves them to operations helping as they go.
+    size_t recoveryMigrators = std::thread::hardware_concurrency();
+    // Chunks of migration work a single operation may take on when it helps.
+    // UNLIMITED_COPY_BUDGET helps until the migration is complete, and zero leaves migration to the migrators.
+    size_t copyBudget = UNLIMITED_COPY_BUDGET;
+    // Where the pages of new tables go among the NUMA nodes.
+    // Left to first touch, a table lands on the node of the thread that formats it, and every other node probes it remotely.
+    PagePlacement placement;
+};
+
+// Parse a copy budget: "unlimited", "none", or a number of chunks.
+inline size_t parseCopyBudget(const std::string &policy)
+{
+    if (policy == "unlimited")
+    {
+        return UNLIMITED_COPY_BUDGET;
+    }
+    if (policy == "none")
+    {
+        return 0;
+    }
+    size_t end = 0;
+    size_t chunks = 0;
+    try
+    {
+        chunks = std::stoul(policy, &end);
+    }
+    catch (const std::logic_error &)
+    {
+    }
+    if (end == 0 || end != policy.size())
+    {
+        throw std::runtime_error("invalid copy budget: " + policy);
+    }
+    return chunks;
+}
 
-template <class Key, class Value, class Hash = std::hash<Key>>
+template <class Key, class Value, class Hash = std::hash<Key>, class Stats = DefaultMapStats>
 class ConcurrentHashMap
 {
     // Sentinels.
@@ -79,11 +306,12 @@ class ConcurrentHashMap
     // Primed tombstone. Marked to prevent any updates to the location, used for resizing.
     static Value TOMBPRIME;
 
-    // Heuristics for resizing.
-    // Consider a reprobes heuristic, or some alternative, to indicate when to resize and gather statistics on key distribution.
-    static size_t reprobeLimit(size_t len)
+    // Marks a failed slot search.
+    static const size_t NO_SLOT = SIZE_MAX;
+    // The most slots a probe sequence covers in a table of the given capacity.
+    size_t reprobeLimit(size_t len)
     {
-        return REPROBE_LIMIT + (len >> 2);
+        return std::min(len, probeLimit);
     }
 
 public:
@@ -97,6 +325,46 @@ public:
         std::atomic<Key> key;
         std::atomic<Value> value;
     } KVpair;
+    // Migration state of a chunk of a table.
+    enum ChunkState : uint64_t
+    {
+        // Slots of the chunk may still be in use, or migrated one at a time.
+        CHUNK_ACTIVE = 0,
+        // Every slot of the chunk is frozen. Its pairs may be partially copied into the next table.
+        CHUNK_FROZEN = 1,
+        // Every pair of the chunk is durably in the next table.
+        CHUNK_DONE = 2
+    };
+    // The persistent header at the start of every table.
+    // Records the table geometry and the migration state of each chunk, followed by the KV pairs.
+    struct TableHeader
+    {
+        uint64_t magic;
+        // The number of pairs that can fit in the table, not counting the stash.
+        uint64_t capacity;
+        // The number of slots in the overflow stash, which follows the other pairs.
+        uint64_t stashSize;
+        // The number of slots in each chunk of migration work.
+        uint64_t chunkSize;
+        // The number of chunks in the table.
+        uint64_t chunkCount;
+
+        // One ChunkState per chunk.
+        std::atomic<uint64_t> *chunks()
+        {
+            return (std::atomic<uint64_t> *)(this + 1);
+        }
+        KVpair *pairs()
+        {
+            return (KVpair *)((char *)this + bytes(chunkCount));
+        }
+        // The size of a header with the given number of chunks, including padding up to the pairs.
+        static size_t bytes(size_t chunkCount)
+        {
+            size_t bytes = sizeof(TableHeader) + sizeof(std::atomic<uint64_t>) * chunkCount;
+            return (bytes + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+        }
+    };
     // A table type.
     // NOTE: Multiple tables can exist at a time during resizing.
     class Table
@@ -106,25 +374,153 @@ public:
         class CHM
         {
 #ifdef RESIZE
-            // The next part of the table to copy.
-            // Represents "work chunks" claimed by resizers.
-            // There is no guarantee that any one thread will actually finish a chunk.
-            std::atomic<size_t> copyIdx;
-            // The amount of chunks completed.
-            // Signals when all resizing is finished.
-            std::atomic<size_t> copyDone;
+            // A contiguous range of chunks handed out to the threads of one NUMA node.
+            struct alignas(CACHELINESZ) Stripe
+            {
+                // The next chunk to claim.
+                // Represents "work chunks" claimed by resizers.
+                // There is no guarantee that any one thread will actually finish a chunk.
+                std::atomic<size_t> next;
+                // One past the last chunk of the stripe.
+                size_t end;
+            };
+            // The parts of the table left to copy, one stripe per NUMA node.
+            Stripe stripes[MAX_COPY_STRIPES];
+            size_t stripeCount;
+            // The number of slots in each chunk of migration work.
+            size_t chunkSize;
+            // The number of chunks in the table.
+            size_t chunkCount;
+            // The next chunk swept by threads that found every chunk handed out.
+            // Shared, so budgeted helpers make progress past chunks other helpers already swept.
+            std::atomic<size_t> sweepNext;
+            // When the migration out of this table started, in steady clock nanoseconds.
+            std::atomic<int64_t> copyStart;
+
+            // Claim up to count chunks, preferring the stripe of the given node.
+            // On success, first and count describe the claimed chunks.
+            // Returns false once every stripe has been handed out.
+            bool claimChunks(size_t node, size_t &first, size_t &count)
+            {
+                for (size_t i = 0; i < stripeCount; i++)
+                {
+                    Stripe &stripe = stripes[(node + i) % stripeCount];
+                    // Avoid pushing an exhausted stripe further.
+                    if (stripe.next.load() >= stripe.end)
+                    {
+                        continue;
+                    }
+                    size_t next = stripe.next.fetch_add(count);
+                    if (next < stripe.end)
+                    {
+                        first = next;
+                        count = std::min(count, stripe.end - next);
+                        return true;
+                    }
+                }
+                return false;
+            }
+            // Migrate every slot of a chunk in bulk.
+            // Rather than persisting each CAS as copySlot does, the chunk is frozen with plain CASes and one persisted chunk state,
+            // its pairs are copied with plain CASes and flushed, and a single fence makes the whole chunk durable.
+            // Recovery uses the chunk state to redo a chunk that was frozen but not finished.
+            // Returns the number of slots this thread retired.
+            size_t copyChunk(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, size_t chunk, Table *oldTable, Table *newTable)
+            {
+                std::atomic<uint64_t> &state = oldTable->chunkState(chunk);
+                // Another thread already finished this chunk.
+                if (state.load() == CHUNK_DONE)
+                {
+                    return 0;
+                }
+                // Keep the chunk's memory from being released while this thread works on it.
+                oldTable->enterChunk(chunk);
+                if (state.load() == CHUNK_DONE)
+                {
+                    oldTable->leaveChunk(hashMap, chunk);
+                    return 0;
+                }
+                size_t workDone = 0;
+                size_t begin = chunk * chunkSize;
+                size_t end = std::min(begin + chunkSize, oldTable->slotCount());
+
+                // Stop all updates to the chunk, unless another thread already has.
+                if (state.load() == CHUNK_ACTIVE)
+                {
+                    for (size_t idx = begin; idx < end; idx++)
+                    {
+                        if (oldTable->freezeSlot(idx))
+                        {
+                            workDone++;
+                        }
+                    }
+                    uint64_t expected = CHUNK_ACTIVE;
+                    state.compare_exchange_strong(expected, CHUNK_FROZEN);
+                    // The chunk must be known to be frozen before any of its copies can be durable.
+                    // This fence also covers the unpersisted values flushed while freezing.
+                    PERSIST(&state, sizeof(state));
+                }
+
+                // Copy the frozen pairs.
+                for (size_t idx = begin; idx < end; idx++)
+                {
+                    // Start fetching where a later pair will land.
+                    if (idx + COPY_PREFETCH_DISTANCE < end)
+                    {
+                        Key ahead = (Key)clearMark(oldTable->pairs[idx + COPY_PREFETCH_DISTANCE].key.load(), DirtyFlag);
+                        __builtin_prefetch(&newTable->pairs[newTable->home(hashKey(ahead))], 1);
+                    }
+                    Value val = (Value)clearMark(oldTable->pairs[idx].value.load(), DirtyFlag);
+                    if (val == TOMBPRIME)
+                    {
+                        continue;
+                    }
+                    assert(isMarked(val, MigrationFlag));
+                    Key key = (Key)clearMark(oldTable->pairs[idx].key.load(), DirtyFlag);
+                    hashMap->copyPair(newTable, key, (Value)clearMark((uintptr_t)val, MigrationFlag));
+                }
+                // Make every copy durable at once.
+                PERSIST_BARRIER_ONLY();
+
+                // Only now may the old slots be given up.
+                for (size_t idx = begin; idx < end; idx++)
+                {
+                    if (oldTable->retireSlot(idx))
+                    {
+                        workDone++;
+                    }
+                }
+                uint64_t expected = CHUNK_FROZEN;
+                // Only the thread that finishes the chunk counts it.
+                if (state.compare_exchange_strong(expected, CHUNK_DONE))
+                {
+                    hashMap->statistics.add(MapCounter::CHUNKS_HELPED);
+                }
+                // Until this is durable, recovery just redoes the chunk.
+                // That is only safe as long as the chunk's memory is kept, so released chunks must be done durably first.
+                if (hashMap->releaseChunks)
+                {
+                    PERSIST(&state, sizeof(state));
+                }
+                else
+                {
+                    PERSIST_FLUSH_ONLY(&state, sizeof(state));
+                }
+                oldTable->leaveChunk(hashMap, chunk);
+                return workDone;
+            }
 
             // Report our completed chunks and, if all chunks are complete, attempt to promote the new table over the old one.
             // hashMap: Our hash map.
             // oldTable: The table that is (as far as we know) currently in place.
             // workDone: Number of completed chunks.
-            void copyCheckAndPromote(ConcurrentHashMap<Key, Value, Hash> *hashMap, Table *oldTable, size_t workDone)
+            void copyCheckAndPromote(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, Table *oldTable, size_t workDone)
             {
                 // We should never attempt to replace our old table with itself.
                 assert(&(oldTable->chm) == this);
 
-                // Get the length of the old table.
-                size_t oldLen = oldTable->len;
+                // Get the number of slots in the old table, stash included.
+                size_t oldLen = oldTable->slotCount();
                 // Get the amount of work already completed.
                 size_t copyDone = this->copyDone.load();
                 // It doesn't make sense to copy over more pairs than existed in the old table.
@@ -138,16 +534,26 @@ public:
                 }
                 // If all values have been transfered.
                 // Attempt table promotion.
-                if (copyDone + workDone == oldLen &&
-                    hashMap->table.compare_exchange_strong(oldTable, newTable))
+                if (copyDone + workDone == oldLen)
                 {
+                    if (!hashMap->table.compare_exchange_strong(oldTable, newTable))
+                    {
+                        hashMap->statistics.casFailed(CasSite::PROMOTE);
+                        return;
+                    }
                     // TODO: Determine when it is safe to deallocate the old table(s).
                     // Perhaps use an atomic counter to track?
+                    // Its storage can go now, though, so recovery never reads it again.
+                    hashMap->retireTable(oldTable);
+                    hashMap->statistics.add(MapCounter::RESIZES_COMPLETED);
+                    hashMap->counters.migrations.fetch_add(1);
+                    hashMap->counters.bytes.fetch_add(oldLen * sizeof(KVpair));
+                    hashMap->counters.migrationNanos.fetch_add(steadyNanos() - copyStart.load());
                 }
                 return;
             }
             // Copy a key-value pair from the old table into the new table.
-            bool copySlot(ConcurrentHashMap<Key, Value, Hash> *hashMap, size_t idx, Table *oldTable, Table *newTable)
+            bool copySlot(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, size_t idx, Table *oldTable, Table *newTable)
             {
                 // A minor optimization to eagerly stop put operations from succeeding by placing a tombstone.
                 Key key;
@@ -183,6 +589,7 @@ public:
                     else
                     {
                         // We failed. Update the old value for CAS and retry.
+                        hashMap->statistics.casFailed(CasSite::SLOT_MIGRATE);
                         oldVal = actualVal;
                     }
                 }
@@ -209,7 +616,9 @@ public:
                 // Only succeeds if there isn't already a value there.
                 // If there is, we say that our write "happened before" the write that placed the existing value.
                 // In that case, we don't need to do anything.
-                bool copiedIntoNew = (hashMap->putIfMatch(newTable, key, oldUnmarked, VINITIAL) == VINITIAL);
+                size_t probes = 0;
+                hashMap->putIfMatch(newTable, key, oldUnmarked, VINITIAL, probes);
+                hashMap->statistics.add(MapCounter::SLOTS_COPIED);
 
                 // Now that the value has been migrated, replace the old table value with a tombstone.
                 // This will prevent other threads from redundantly attempting to copy to the new table.
@@ -219,13 +628,17 @@ public:
                 Value actualVal = CASvalue(oldTable, idx, oldVal, TOMBPRIME);
                 while (actualVal != oldVal)
                 {
+                    hashMap->statistics.casFailed(CasSite::SLOT_MIGRATE);
                     oldVal = actualVal;
                     actualVal = CASvalue(oldTable, idx, oldVal, TOMBPRIME);
                 }
-                // Return whether or not we made progress (copied a value from the old table to the new table).
+                // Return whether or not we made progress (retired the old slot).
+                // Only the thread whose CAS placed the tombprime counts the slot, so no slot is ever counted twice.
+                // Counting successful copies instead over-counts once the new table is itself migrating:
+                // a redundant copy can land in a newer table that no longer holds the key.
                 // Note: Stalling threads may delay reporting of completed migrations.
                 // This means old tables may continue to exist for longer than we like, but it shouldn't hurt correctness.
-                return copiedIntoNew;
+                return oldVal != TOMBPRIME;
             }
 #endif
         public:
@@ -233,7 +646,7 @@ public:
             // If this number gets too large, consider resizing.
             std::atomic<size_t> size;
 
-            // The number of usable slots.
+            // The number of claimed key slots, including deleted and migrated keys.
             // If this number gets too large, consider resizing.
             std::atomic<size_t> slots;
 
@@ -241,9 +654,26 @@ public:
             // This ID maps to the underlying file name for this table.
             size_t id;
 #ifdef RESIZE
+            // The amount of slots completed.
+            // Signals when all resizing is finished.
+            std::atomic<size_t> copyDone;
             // A replacement table.
             // All values in the current table must migrate here before deallocating the current table.
             std::atomic<Table *> newTable;
+            // Start each stripe after the chunks a recovered table had already finished.
+            // Chunks are finished roughly in the order they are claimed, so this skips most of the migration done before a crash.
+            void skipDoneChunks(Table *table)
+            {
+                for (size_t i = 0; i < stripeCount; i++)
+                {
+                    size_t next = stripes[i].next.load();
+                    while (next < stripes[i].end && table->chunkState(next).load() == CHUNK_DONE)
+                    {
+                        next++;
+                    }
+                    stripes[i].next.store(next);
+                }
+            }
             // Place a new table.
             // If multiple resizers attempt this, they race to succeed.
             bool CASNewTable(Table *newTable)
@@ -253,6 +683,11 @@ public:
                 while (true)
                 {
                     ret = this->newTable.compare_exchange_strong(oldTable, newTable);
+                    if (ret)
+                    {
+                        // The migration starts now.
+                        copyStart.store(steadyNanos());
+                    }
                     // If we succeeded here.
                     if (ret ||
                         // If someone else already succeeded here.
@@ -266,33 +701,60 @@ public:
 #endif
             // The CHM constructor.
             // The CHM tracks control structure data for the hash table, particularly involving resizing.
-            CHM(size_t tableCapacity = Table::MIN_SIZE, size_t existingSize = 0, size_t id = 0)
+            // slotCount includes the stash.
+            CHM(size_t slotCount = Table::MIN_SIZE, size_t chunkSize = Table::MIN_SIZE, size_t existingSize = 0, size_t id = 0)
             {
                 this->size.store(existingSize);
-                slots.store(tableCapacity);
+                slots.store(0);
                 this->id = id;
 #ifdef RESIZE
                 newTable.store(nullptr);
-                copyIdx.store(0);
                 copyDone.store(0);
+                copyStart.store(0);
+                sweepNext.store(0);
+                // Split the table into chunks, and the chunks into one stripe per node.
+                this->chunkSize = chunkSize;
+                chunkCount = (slotCount + chunkSize - 1) / chunkSize;
+                stripeCount = std::min(std::min(numaNodeCount(), MAX_COPY_STRIPES), chunkCount);
+                for (size_t i = 0; i < stripeCount; i++)
+                {
+                    stripes[i].next.store(chunkCount * i / stripeCount);
+                    stripes[i].end = chunkCount * (i + 1) / stripeCount;
+                }
 #endif
             }
 
-            // Heuristic to estimate if the table is overfull.
+            // Whether the keys claimed in a table of capacity len have reached the target load factor.
             // This will prevent the load factor from getting too high.
-            bool tableFull(size_t reprobeCount, size_t len)
+            bool tableFull(size_t len, double loadFactor)
             {
-                // A cheap check to potentially avoid the atomic get.
-                // Just check how many times we reprobed initially.
-                // If we reprobed too far, this suggests an overfull table.
-                return reprobeCount >= REPROBE_LIMIT &&
-                       // If the table is over 1/4 full.
-                       slots.load() >= REPROBE_LIMIT + (len / 4);
+                return slots.load() >= loadFactor * len;
+            }
+            // The capacity of the table that replaces a table of capacity oldLen.
+            static size_t newTableSize(size_t oldLen, double growth)
+            {
+                size_t newSize = (size_t)(oldLen * growth);
+                // Round up to a whole number of minimum-size tables.
+                newSize = (newSize + Table::MIN_SIZE - 1) / Table::MIN_SIZE * Table::MIN_SIZE;
+                // The table must always grow, or we get stuck in a loop of resizing to the same size then failing to insert.
+                return std::max(newSize, oldLen + Table::MIN_SIZE);
+            }
+            // Pick a chunk size for migrating a table of the given length.
+            // The choice is recorded in the table header, so it survives recovery on a different machine.
+            static size_t copyChunkSize(size_t len)
+            {
+                size_t threads = std::max((size_t)std::thread::hardware_concurrency(), (size_t)1);
+                size_t chunk = MIN_COPY_WORK;
+                while (chunk < MAX_COPY_WORK && chunk * threads * CHUNKS_PER_THREAD < len)
+                {
+                    chunk <<= 1;
+                }
+                return std::min(chunk, len);
             }
 #ifdef RESIZE
             // A wait-free resize.
             // NOTE: Currently, our resize is implicitly only used when the table needs to expand.
-            Table *resize(ConcurrentHashMap<Key, Value, Hash> *hashMap, Table *table)
+            Table *resize(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, Table *table)
             {
                 // Check for a resize in progress.
                 // If one is found, return the already-existing new table.
@@ -309,33 +771,12 @@ public:
                 size_t oldLen = table->len;
                 // Current number of KV pairs stored in the table.
                 size_t size = this->size.load();
-                // An initial size estimate.
-                size_t newSize = size;
-
-                // Heuristic to determine a new size.
-                // If we are >25% full of keys.
-                if (size >= (oldLen / 4))
-                {
-                    // Double size.
-                    newSize = oldLen << 1;
-                    // If we are >50% full of keys.
-                    if (size >= (oldLen / 2))
-                    {
-                        // Effectively quadruple size.
-                        newSize = oldLen << 1;
-                    }
-                }
-
-                // TODO: (Low priority) Consider the last resize. If it was recent, then double again.
-                // This helps reduce the number of resizes, particularly early on.
-
-                // The table must always grow.
-                if (newSize <= oldLen)
+                size_t newSize = newTableSize(oldLen, hashMap->growthFactor);
+                // If this table filled up while a migration into it is still underway, growth is outpacing migration.
+                // Skip a generation, so pairs still arriving are not copied yet again.
+                if (hashMap->table.load() != table)
                 {
-                    //newSize = oldLen;
-                    // Always enforce a larger table upon resize.
-                    // For some reason, without this, we are getting stuck in a loop of resizing (to the same size) then failing to insert, repeating in a vicious cycle.
-                    newSize = oldLen << 1;
+                    newSize = newTableSize(newSize, hashMap->growthFactor);
                 }
 
                 // Check one last time to make sure the table has not yet been allocated.
@@ -347,23 +788,28 @@ public:
                     return newTable;
                 }
 
-                // Using a shared counter means more contention, but guaranteed file ordering.
-                size_t count = fileNameCounter.fetch_add(1);
-                // Allocate the new table.
-                std::string filename = getOrderedFileName(count);
-                newTable = mmapTable(true, newSize, size, filename.c_str());
+                // Use a table prepared ahead of time, if there is a suitable one.
+                newTable = hashMap->takeSpareTable(table, newSize, size);
+                if (newTable == nullptr)
+                {
+                    // Allocate the new table.
+                    newTable = hashMap->allocTable(newSize, size);
+                }
 
                 // Attempt to CAS the new table.
                 // Only one thread can succeed here.
                 if (CASNewTable(newTable))
                 {
                     // We succeeded.
+                    hashMap->statistics.add(MapCounter::RESIZES_STARTED);
+                    hashMap->wakeMigrators();
                 }
                 else
                 {
                     // Failure means some other thread succeeded.
-                    // Free the allocated memory.
-                    munmapTable(newTable);
+                    hashMap->statistics.casFailed(CasSite::NEW_TABLE);
+                    // Keep the allocated table around for the next resize.
+                    hashMap->returnSpareTable(newTable);
                     // And get the table that was placed.
                     newTable = this->newTable.load();
                     // The new table should never be NULL.
@@ -374,7 +820,7 @@ public:
             }
 
             // Copy a key-value pair, report the migration, and attempt to promote the table if all migration work is complete.
-            Table *copySlotAndCheck(ConcurrentHashMap<Key, Value, Hash> *hashMap, Table *oldTable, size_t idx, bool shouldHelp)
+            Table *copySlotAndCheck(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, Table *oldTable, size_t idx, bool shouldHelp)
             {
                 // We should never migrate into the old table.
                 assert(&(oldTable->chm) == this);
@@ -394,8 +840,9 @@ public:
             }
 
             // Help migrate the table.
-            // Do not migrate the whole table by default.
-            void helpCopyImpl(ConcurrentHashMap<Key, Value, Hash> *hashMap, Table *oldTable, bool copyAll = false)
+            // Stops once the migration is complete, or after working on budget chunks.
+            // Returns the number of chunks worked on.
+            size_t helpCopyImpl(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, Table *oldTable, size_t budget = UNLIMITED_COPY_BUDGET)
             {
                 // We should never migrate into the old table.
                 assert(&(oldTable->chm) == this);
@@ -403,49 +850,62 @@ public:
                 Table *newTable = this->newTable.load();
                 // Don't bother copying if there isn't even a table transfer in progress.
                 assert(newTable != nullptr);
-                // Get the size of our old table.
-                size_t oldLen = oldTable->len;
-                // We will attempt to copy in chunks of 1024 key-value pairs at a time.
-                const size_t MIN_COPY_WORK = (oldLen < 1024) ? oldLen : 1024;
+                // Get the number of slots in our old table, stash included.
+                size_t oldLen = oldTable->slotCount();
+                // Claim chunks near the memory of this thread's node first.
+                size_t node = currentNumaNode();
+                // The number of chunks this thread claims at once, tuned by how long claims take.
+                static thread_local size_t claimSize = 1;
 
                 // By default, we have not panicked.
-                long panicStart = -1;
-                // This is the index where our chunk starts.
-                size_t copyIdx;
+                bool panic = false;
+                // The number of chunks worked on so far.
+                size_t spent = 0;
+
+                // Migrate the stash before anything else.
+                // Long probes fall back on the stash, so no chunk may be released until the stash is done. See Table::releasable.
+                // Stash chunks count against the budget like any other.
+                size_t stashWork = 0;
+                for (size_t chunk = oldTable->len / chunkSize; chunk < chunkCount && spent < budget; chunk++)
+                {
+                    if (oldTable->chunkState(chunk).load() != CHUNK_DONE)
+                    {
+                        stashWork += copyChunk(hashMap, chunk, oldTable, newTable);
+                        spent++;
+                    }
+                }
+                if (stashWork > 0)
+                {
+                    copyCheckAndPromote(hashMap, oldTable, stashWork);
+                }
 
-                // If copying is not yet complete.
-                while (copyDone.load() < oldLen)
+                // If copying is not yet complete, and we may do more.
+                while (copyDone.load() < oldLen && spent < budget)
                 {
+                    // This is the chunk where our work starts.
+                    size_t first;
+                    size_t count = std::min(claimSize, budget - spent);
                     // If we have not yet panicked.
-                    if (panicStart == -1)
+                    // Try to claim some chunks of work.
+                    if (!panic && !claimChunks(node, first, count))
                     {
-                        // Try to claim a chunk of work.
-                        copyIdx = this->copyIdx.load();
-                        while (copyIdx < (oldLen << 1) &&
-                               !this->copyIdx.compare_exchange_strong(copyIdx, copyIdx + MIN_COPY_WORK))
-                        {
-                        }
-                        // Panic if the threads have collectively attempted to copy the table twice, yet the work still isn't done.
-                        if (copyIdx >= (oldLen << 1))
-                        {
-                            // Record where the panic occurred.
-                            panicStart = copyIdx;
-                        }
+                        // Panic if every chunk has been handed out, yet the work still isn't done.
+                        // Some thread holding a chunk may have stalled, so sweep the whole table ourselves.
+                        panic = true;
+                    }
+                    if (panic)
+                    {
+                        first = sweepNext.fetch_add(1) % chunkCount;
+                        count = 1;
                     }
+                    spent += count;
 
-                    // Now that we have claimed a chunk of work, work on it.
+                    // Now that we have claimed some work, work on it.
+                    int64_t claimStart = steadyNanos();
                     size_t workDone = 0;
-                    // For each index in our chunk.
-                    for (size_t i = 0; i < MIN_COPY_WORK; i++)
+                    for (size_t chunk = first; chunk < first + count; chunk++)
                     {
-                        // Copy from the old table to the new table.
-                        // If we successfully modified the old slot to disallow key replacement.
-                        // Note how we "logical and" with oldLen to allow multiple rounds of migration attempts.
-                        if (copySlot(hashMap, (copyIdx + i) & (oldLen - 1), oldTable, newTable))
-                        {
-                            // Count it.
-                            workDone++;
-                        }
+                        workDone += copyChunk(hashMap, chunk, oldTable, newTable);
                     }
                     // If we got *something* done.
                     if (workDone > 0)
@@ -453,85 +913,315 @@ public:
                         // Tell the other threads about it.
                         copyCheckAndPromote(hashMap, oldTable, workDone);
                     }
-                    // Move on to the next chunk of work.
-                    copyIdx += MIN_COPY_WORK;
-
-                    // Stop working after just doing the bare minimum amount of work.
-                    // NOTE: This can be commented out to instead keep taking on additional chunks of work until the whole resize process is complete.
-                    // if (!copyAll && panicStart == -1)
-                    // {
-                    //     return;
-                    // }
+                    // Claim more chunks next time if this claim was quick, fewer if it was slow.
+                    int64_t elapsed = steadyNanos() - claimStart;
+                    if (elapsed < COPY_CLAIM_TARGET.count() / 2 && claimSize < MAX_COPY_CLAIM)
+                    {
+                        claimSize <<= 1;
+                    }
+                    else if (elapsed > COPY_CLAIM_TARGET.count() * 2 && claimSize > 1)
+                    {
+                        claimSize >>= 1;
+                    }
                 }
                 // Try to promote the hashtable anyway, in case another thread stalled during the promotion phase.
                 copyCheckAndPromote(hashMap, oldTable, 0);
-                return;
+                return spent;
+            }
+            // Copy one chunk, whether or not it was claimed, and promote the new table if that was the last one.
+            void migrateChunk(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, Table *oldTable, size_t chunk)
+            {
+                assert(&(oldTable->chm) == this);
+                copyCheckAndPromote(hashMap, oldTable, copyChunk(hashMap, chunk, oldTable, newTable.load()));
             }
 #endif
         };
         // NOTE: Hashes are only needed if pointer comparison is insufficient for comparison, so we don't use it in this implementation.
+        // The persistent header, at the start of the table's memory.
+        TableHeader *header;
         // Keys and values.
         KVpair *pairs;
 
         // Minimum table size.
-        // Must always be a power of two.
+        // Every capacity is a multiple of this.
         const static size_t MIN_SIZE = 1 << 3;
 
         // CHM: Hash Table Control Structure.
         CHM chm;
-        // The number of pairs that can fit in the table.
+        // The number of pairs that can fit in the table, not counting the stash.
+        // Probe sequences wrap around at this length.
         size_t len;
+        // The number of slots in the overflow stash, at indices len and up.
+        size_t stashLen;
+#ifdef RESIZE
+        // The number of threads copying each chunk, plus CHUNK_RELEASED once the chunk's memory is released.
+        std::atomic<uint32_t> *chunkWorkers;
+        static const uint32_t CHUNK_RELEASED = (uint32_t)1 << 31;
+#endif
 
-        Table(size_t tableCapacity, size_t existingSize, size_t id, KVpair *pairs = NULL)
+        // Wrap a formatted table.
+        Table(TableHeader *header, size_t existingSize, size_t id)
         {
-            assert(tableCapacity % 2 == 0);
+            assert(header != NULL);
+            if (header->magic != TABLE_MAGIC)
+            {
+                throw std::runtime_error("table header is corrupt");
+            }
+            size_t tableCapacity = header->capacity;
+            assert(tableCapacity % MIN_SIZE == 0);
             assert(tableCapacity >= MIN_SIZE);
-            new (&chm) CHM(tableCapacity, existingSize, id);
-            assert(pairs != NULL);
-            this->pairs = pairs;
+            new (&chm) CHM(tableCapacity + header->stashSize, header->chunkSize, existingSize, id);
+            this->header = header;
+            pairs = header->pairs();
             len = tableCapacity;
+            stashLen = header->stashSize;
+#ifdef RESIZE
+            chunkWorkers = new std::atomic<uint32_t>[header->chunkCount]();
+#endif
             return;
         }
         ~Table()
         {
+#ifdef RESIZE
+            delete[] chunkWorkers;
+#endif
             return;
         }
+        // The number of slots, stash included.
+        size_t slotCount()
+        {
+            return len + stashLen;
+        }
+        // The slot a hash belongs in.
+        // Lemire's multiply-shift range reduction takes the high bits of hash * len, so the capacity need not be a power of two.
+        size_t home(size_t hash)
+        {
+            return reduce(hash, len);
+        }
+        static size_t reduce(size_t hash, size_t len)
+        {
+            return (size_t)(((unsigned __int128)hash * len) >> 64);
+        }
+        // The slot after idx in a probe sequence.
+        size_t next(size_t idx)
+        {
+            return ++idx == len ? 0 : idx;
+        }
         // Function to get a key at an index.
         Key key(size_t idx)
         {
-            assert(idx < len);
+            assert(idx < slotCount());
             Key ret = pcas_read<Key>(&pairs[idx].key);
+#ifdef RESIZE
+            // A released slot reads as the end of a probe. See releasable.
+            if (ret == 0 && released(idx))
+            {
+                return KTOMBSTONE;
+            }
+#endif
             return ret;
         }
         // Function to get a value at an index.
         Value value(size_t idx)
         {
-            assert(idx < len);
+            assert(idx < slotCount());
             Value ret = pcas_read<Value>(&pairs[idx].value);
+#ifdef RESIZE
+            if (ret == 0 && released(idx))
+            {
+                return TOMBPRIME;
+            }
+#endif
             return ret;
         }
         // Function to CAS a key.
         Key CASkey(size_t idx, Key oldKey, Key newKey)
         {
-            assert(idx < len);
+            assert(idx < slotCount());
             Key oldKeyRef = oldKey;
             pcas<Key>(&pairs[idx].key, oldKeyRef, newKey);
+#ifdef RESIZE
+            // A stalled thread may write into released memory. Its write counts as failed, and nobody reads it.
+            if ((Key)clearMark(oldKeyRef, DirtyFlag) == 0 && released(idx))
+            {
+                return KTOMBSTONE;
+            }
+#endif
             return oldKeyRef;
         }
+#ifdef RESIZE
+        // Whether a slot may be in released memory.
+        // Released memory reads as zero, which is no sentinel, so only reads of zero need to check.
+        // Slots of done chunks are all retired, so treating them as released is always safe.
+        bool released(size_t idx)
+        {
+            return chunkState(idx / header->chunkSize).load() == CHUNK_DONE;
+        }
+        // Register a thread copying a chunk.
+        void enterChunk(size_t chunk)
+        {
+            chunkWorkers[chunk].fetch_add(1);
+        }
+        // Unregister a thread copying a chunk.
+        // The last one out of a done chunk releases its memory, and that of any earlier chunk that was only waiting for this one.
+        void leaveChunk(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, size_t chunk)
+        {
+            uint32_t workers = chunkWorkers[chunk].fetch_sub(1) - 1;
+            if (workers != 0 || !hashMap->releaseChunks || chunkState(chunk).load() != CHUNK_DONE)
+            {
+                return;
+            }
+            size_t chunkSize = header->chunkSize;
+            size_t mainChunks = (len + chunkSize - 1) / chunkSize;
+            // Every chunk waits for the stash.
+            if (chunk >= len / chunkSize)
+            {
+                for (size_t stashChunk = len / chunkSize; stashChunk < header->chunkCount; stashChunk++)
+                {
+                    tryReleaseChunk(hashMap, stashChunk);
+                }
+            }
+            // Main chunks wait for the chunks their probes run on into, wrapping around.
+            if (chunk < mainChunks)
+            {
+                size_t behind = std::min((hashMap->reprobeLimit(len) + chunkSize - 1) / chunkSize, mainChunks - 1);
+                for (size_t i = 0; i <= behind; i++)
+                {
+                    tryReleaseChunk(hashMap, (chunk + mainChunks - i) % mainChunks);
+                }
+            }
+        }
+        // Release the memory of a chunk, if it is done, nobody is copying it, and no probe still needs it.
+        void tryReleaseChunk(ConcurrentHashMap<Key, Value, Hash, Stats> *hashMap, size_t chunk)
+        {
+            uint32_t idle = 0;
+            if (chunkWorkers[chunk].load() == 0 && releasable(chunk, hashMap->reprobeLimit(len)) &&
+                chunkWorkers[chunk].compare_exchange_strong(idle, CHUNK_RELEASED))
+            {
+                hashMap->counters.releasedBytes.fetch_add(releaseChunk(chunk));
+            }
+        }
+        // Whether every chunk holding a slot in [begin, end) is done.
+        bool chunksDone(size_t begin, size_t end)
+        {
+            for (size_t chunk = begin / header->chunkSize; chunk * header->chunkSize < end; chunk++)
+            {
+                if (chunkState(chunk).load() != CHUNK_DONE)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // Whether the memory of a chunk may be released.
+        // A released slot reads as the end of a probe, which sends the probe on to the next table.
+        // That is only right once a probe through the chunk can find nothing left to copy further on:
+        // not in the reach slots after the chunk, wrapping around, nor in the stash that long probes fall back on.
+        bool releasable(size_t chunk, size_t reach)
+        {
+            if (chunkState(chunk).load() != CHUNK_DONE || !chunksDone(len, slotCount()))
+            {
+                return false;
+            }
+            // The stash is searched in order from its start, so a done stash is all that stash chunks need.
+            if (chunk * header->chunkSize >= len)
+            {
+                return true;
+            }
+            size_t end = std::min((chunk + 1) * header->chunkSize, len);
+            if (end + reach <= len)
+            {
+                return chunksDone(end, end + reach);
+            }
+            return chunksDone(end, len) && chunksDone(0, end + reach - len);
+        }
+        // Give the whole pages of a chunk back to the file system. They read as zero afterwards.
+        // Returns the number of bytes released.
+        size_t releaseChunk(size_t chunk)
+        {
+            size_t begin = chunk * header->chunkSize;
+            size_t end = std::min(begin + header->chunkSize, slotCount());
+            uintptr_t first = ((uintptr_t)&pairs[begin] + TABLE_ALIGN - 1) / TABLE_ALIGN * TABLE_ALIGN;
+            uintptr_t last = (uintptr_t)&pairs[end] / TABLE_ALIGN * TABLE_ALIGN;
+            // Memory that cannot be punched, like device-DAX, is simply kept.
+            if (last <= first || madvise((void *)first, last - first, MADV_REMOVE) != 0)
+            {
+                return 0;
+            }
+            return last - first;
+        }
+#endif
+        // The migration state of a chunk.
+        std::atomic<uint64_t> &chunkState(size_t chunk)
+        {
+            assert(chunk < header->chunkCount);
+            return header->chunks()[chunk];
+        }
+        // Freeze a slot for bulk migration, without persisting anything.
+        // Unpersisted values are flushed first, so the caller only has to fence.
+        // Returns whether this thread retired the slot, which happens when it held no value.
+        bool freezeSlot(size_t idx)
+        {
+            assert(idx < slotCount());
+            // Stop keys from being placed.
+            Key key = pairs[idx].key.load();
+            while ((Key)clearMark(key, DirtyFlag) == KINITIAL &&
+                   !pairs[idx].key.compare_exchange_strong(key, KTOMBSTONE))
+            {
+            }
+            // Stop values from being changed.
+            Value val = pairs[idx].value.load();
+            while (!isMarked(val, MigrationFlag))
+            {
+                if (isMarked(val, DirtyFlag))
+                {
+                    PERSIST_FLUSH_ONLY(&pairs[idx], sizeof(KVpair));
+                }
+                Value unmarked = (Value)clearMark(val, DirtyFlag);
+                Value mark = (unmarked == VINITIAL || unmarked == VTOMBSTONE) ? TOMBPRIME : (Value)setMark(unmarked, MigrationFlag);
+                if (pairs[idx].value.compare_exchange_strong(val, mark))
+                {
+                    return mark == TOMBPRIME;
+                }
+            }
+            return false;
+        }
+        // Give up a frozen slot whose pair has durably been copied, without persisting anything.
+        // Returns whether this thread retired the slot.
+        bool retireSlot(size_t idx)
+        {
+            assert(idx < slotCount());
+            Value val = pairs[idx].value.load();
+            while ((Value)clearMark(val, DirtyFlag) != TOMBPRIME)
+            {
+                assert(isMarked(val, MigrationFlag));
+                if (pairs[idx].value.compare_exchange_strong(val, TOMBPRIME))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
         // Function to CAS a value.
         // Can be replaced with an alternative, conditional CAS function.
         static Value CASvalue(Table *table, size_t idx, Value oldValue, Value newValue)
         {
-            assert(idx < table->len);
+            assert(idx < table->slotCount());
             Value oldValueRef = oldValue;
             pcas<Value>(&table->pairs[idx].value, oldValueRef, newValue);
+#ifdef RESIZE
+            if ((Value)clearMark(oldValueRef, DirtyFlag) == 0 && table->released(idx))
+            {
+                return TOMBPRIME;
+            }
+#endif
             return oldValueRef;
         }
         // Example conditional CAS replacement.
         // Increments the value associated with a key.
         static Value increment(Table *table, size_t idx, Value oldValue, Value newValue)
         {
-            assert(idx < table->len);
+            assert(idx < table->slotCount());
             Key oldValueRef = oldValue;
             if (oldValue == VINITIAL || oldValue == VTOMBSTONE)
             {
@@ -542,12 +1232,18 @@ public:
             newValue = ((oldValue >> BITS_MARKED) + 1) << BITS_MARKED;
             // Must be CAS rather than FAA because the old value might be a sentinel.
             pcas<Value>(&table->pairs[idx].value, oldValueRef, newValue);
+#ifdef RESIZE
+            if ((Value)clearMark(oldValueRef, DirtyFlag) == 0 && table->released(idx))
+            {
+                return TOMBPRIME;
+            }
+#endif
             return oldValueRef;
         }
-        // TODO: Grab count and store in CHM.
-        static std::string getOrderedFileName(size_t count)
+        // The file of table number count in a directory.
+        static std::string getOrderedFileName(const std::string &fileDir, size_t count)
         {
-            return "/mnt/pmem/pm1/tables/" + std::to_string(count) + ".dat";
+            return (std::filesystem::path(fileDir) / (std::to_string(count) + ".dat")).string();
         }
         // Take a full table name with path and keep only the associated number.
         static size_t numFromName(const char *source)
@@ -589,10 +1285,16 @@ public:
             dest[idx] = '\n';
             // Convert the string to an integer.
             size_t ret = atoi(dest);
+            free(dest);
             // Return the integer.
             return ret;
         }
-        static Table *mmapTable(bool newTable, size_t tableCapacity, size_t existingSize = 0, const char *constFileName = NULL)
+        // Map a table file, creating and formatting a new one unless newTable is set and the file exists.
+        // Without a file name, the table gets the next numbered file in fileDir.
+        // A new table's pages are placed before they are formatted.
+        // Returns NULL for an existing file that never finished formatting.
+        static Table *mmapTable(const std::string &fileDir, bool newTable, size_t tableCapacity, size_t existingSize = 0, const char *constFileName = NULL,
+                                const PagePlacement &placement = PagePlacement())
         {
             // This is the name and location of our persistent memory file for this table.
             std::string filenameString;
@@ -601,7 +1303,7 @@ public:
             // This will hold the file descriptor of our memory mapped file.
             int fd;
             // This will hold the memory address of our memory mapped table.
-            KVpair *pairs = NULL;
+            TableHeader *header = NULL;
             // The table we ultimately return.
             Table *table = NULL;
 
@@ -609,7 +1311,7 @@ public:
             if (constFileName == NULL)
             {
                 count = fileNameCounter.fetch_add(1);
-                filenameString = Table::getOrderedFileName(count);
+                filenameString = Table::getOrderedFileName(fileDir, count);
                 fileName = filenameString.c_str();
             }
             else
@@ -645,58 +1347,35 @@ public:
                     fprintf(stderr, "Failed to read the existing file's size.\n");
                 }
                 size_t length = finfo.st_size;
-                // length should always be some multiple of our KVpair size.
-                assert(length % sizeof(KVpair) == 0);
-                size_t size = length / sizeof(KVpair);
+                // A table that never finished formatting was never linked, so it holds nothing.
+                if (length < sizeof(TableHeader))
+                {
+                    close(fd);
+                    return NULL;
+                }
 
                 // Map the file.
-                pairs = (KVpair *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-                if ((intptr_t)pairs == -1)
+                header = (TableHeader *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if ((intptr_t)header == -1)
                 {
                     // Error.
                     std::cerr << "Failed to mmap the existing file. errno = "
                               << errno << ", " << strerror(errno) << std::endl;
                     throw std::logic_error("mmap existing file failed.");
                 }
-
-                // Allocate our table.
-                // We pass in the asigned location of our KV pairs to assign them to the structure.
-                // We pass in the size of the table to assign the length.
-                table = new Table(size, existingSize, count, pairs);
-
-                // Use the KV pairs to infer the number of used and free entries in the table.
-                table->chm.size.store(0);
-                table->chm.slots.store(0);
-                for (size_t i = 0; i < size; i++)
+                if (header->magic != TABLE_MAGIC)
                 {
+                    munmap(header, length);
+                    close(fd);
+                    return NULL;
+                }
 
-                    Value V = table->value(i);
-                    Key K = table->key(i);
-
-                    // While we're at it, check for inconsistent table entries.
-                    // THis is the only situation I've come up with where we could have a problem with partial persists.
-                    if (K != KINITIAL && V == VINITIAL)
-                    {
-                        // If the key has been set but the value hasn't, then we have an incomplete insert on our hands.
-                        // Just make it a tombstone since we don't know what value it should have been.
-                        Table::CASvalue(table, i, VINITIAL, VTOMBSTONE);
-                        // Update the replaced value for subsequent use in this loop.
-                        V = table->value(i);
-                        // We should always succeed. We are running sequentially, after all.
-                        assert(V == VTOMBSTONE);
-                    }
-
-                    // Anything that's not a sentinel.
-                    if (V != VINITIAL && V != VTOMBSTONE && V != TOMBPRIME)
-                    {
-                        table->chm.size.fetch_add(1);
-                    }
-                    // Anything left that's not a tombstone.
-                    else if (V != VTOMBSTONE && V != TOMBPRIME)
-                    {
-                        table->chm.slots.fetch_add(1);
-                    }
-                }
+                // Allocate our table.
+                // The header records the length of the table.
+                table = new Table(header, existingSize, count);
+                // The file should always hold the whole table.
+                assert(length >= table->bytes());
+                table->recover();
             }
             // If the file doesn't exist yet, try to make it.
             else
@@ -709,8 +1388,8 @@ public:
                     std::cerr << "Failed to create or open the file." << std::endl;
                     throw std::runtime_error("cannot create or open file");
                 }
-                // Allocate enough space for the KV pairs.
-                size_t length = sizeof(KVpair) * tableCapacity;
+                // Allocate enough space for the header and KV pairs.
+                size_t length = Table::bytes(tableCapacity);
                 // Truncate will actually extend the size of the file by filling with NULL.
                 if (ftruncate(fd, length) == -1)
                 {
@@ -719,8 +1398,8 @@ public:
                     throw std::runtime_error("cannot create or open file");
                 }
                 // Allocate our file.
-                KVpair *pairs = (KVpair *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-                if ((intptr_t)pairs == -1)
+                void *memory = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if ((intptr_t)memory == -1)
                 {
                     // Error.
                     std::cerr << "Failed to mmap a new file. errno = "
@@ -728,21 +1407,12 @@ public:
                     throw std::logic_error("mmap new file failed.");
                 }
                 // Ensure the allocation is actually to persistent memory.
-                //assert(pmem_is_pmem(pairs, length));
+                //assert(pmem_is_pmem(memory, length));
+                place(memory, length, placement);
                 // Initialize the new file.
-                for (size_t i = 0; i < tableCapacity; i++)
-                {
-                    // Initialize these to a default, reserved value.
-                    pairs[i].key.store((Key)setMark(KINITIAL, DirtyFlag));
-                    pairs[i].value.store((Value)setMark(VINITIAL, DirtyFlag));
-                }
-                // Persist all keys and values.
-                // Everything else can be inferred upon recovery.
-                PERSIST(pairs, sizeof(KVpair) * tableCapacity);
+                header = format(memory, tableCapacity);
                 // Allocate our table.
-                // We pass in the location of our KV pairs to assign them to the structure.
-                // We pass in the size of the table to assign the length.
-                table = new Table(tableCapacity, existingSize, count, pairs);
+                table = new Table(header, existingSize, count);
             }
             // After the mmap() call has returned, the file descriptor, fd, can be closed immediately, without invalidating the mapping.
             close(fd);
@@ -750,96 +1420,334 @@ public:
             // Return the mapped table.
             return table;
         }
+        // Apply a page placement to new table memory. Failure only costs locality, so it is reported once and otherwise ignored.
+        static void place(void *memory, size_t length, const PagePlacement &placement)
+        {
+            static std::atomic<bool> reported{false};
+            if (!placement.apply(memory, length) && !reported.exchange(true))
+            {
+                std::cerr << "Cannot place table pages with policy " << placement.describe() << ": " << strerror(errno) << std::endl;
+            }
+        }
         static bool munmapTable(Table *table)
         {
-            size_t size = table->chm.size.load();
-            bool ret = (munmap(table, (sizeof(KVpair) * size)) != 0);
+            bool ret = (munmap(table->header, table->bytes()) != 0);
             delete table;
             return ret;
         }
+        // The number of bytes needed for a table of the given capacity, header included.
+        static size_t bytes(size_t tableCapacity)
+        {
+            size_t slotCount = tableCapacity + STASH_SIZE;
+            size_t chunkSize = CHM::copyChunkSize(slotCount);
+            return TableHeader::bytes((slotCount + chunkSize - 1) / chunkSize) + sizeof(KVpair) * slotCount;
+        }
+        // The number of bytes this table occupies, header included.
+        size_t bytes()
+        {
+            return TableHeader::bytes(header->chunkCount) + sizeof(KVpair) * slotCount();
+        }
+        // Lay out and persist an empty table of the given capacity in memory of Table::bytes(tableCapacity) bytes.
+        static TableHeader *format(void *memory, size_t tableCapacity)
+        {
+            TableHeader *header = (TableHeader *)memory;
+            size_t slotCount = tableCapacity + STASH_SIZE;
+            header->capacity = tableCapacity;
+            header->stashSize = STASH_SIZE;
+            header->chunkSize = CHM::copyChunkSize(slotCount);
+            header->chunkCount = (slotCount + header->chunkSize - 1) / header->chunkSize;
+            for (size_t i = 0; i < header->chunkCount; i++)
+            {
+                header->chunks()[i].store(CHUNK_ACTIVE);
+            }
+            initPairs(header->pairs(), slotCount);
+            // The magic goes last, so a partially formatted table is never mistaken for a real one.
+            PERSIST(header, TableHeader::bytes(header->chunkCount));
+            header->magic = TABLE_MAGIC;
+            PERSIST(&header->magic, sizeof(header->magic));
+            return header;
+        }
+        // Fill freshly allocated KV pairs with the initial sentinels and persist them.
+        static void initPairs(KVpair *pairs, size_t tableCapacity)
+        {
+            for (size_t i = 0; i < tableCapacity; i++)
+            {
+                // Initialize these to a default, reserved value.
+                pairs[i].key.store((Key)setMark(KINITIAL, DirtyFlag));
+                pairs[i].value.store((Value)setMark(VINITIAL, DirtyFlag));
+            }
+            // Persist all keys and values.
+            // Everything else can be inferred upon recovery.
+            PERSIST(pairs, sizeof(KVpair) * tableCapacity);
+        }
+        // Use the KV pairs of a recovered table to infer the number of used and free entries in the table.
+        // Chunk states are the persisted migration progress: chunks already done are credited whole, and are not claimed again.
+        void recover()
+        {
+            chm.size.store(0);
+            chm.slots.store(0);
+#ifdef RESIZE
+            chm.copyDone.store(0);
+#endif
+            for (size_t chunk = 0; chunk < header->chunkCount; chunk++)
+            {
+                uint64_t state = chunkState(chunk).load();
+                size_t begin = chunk * header->chunkSize;
+                size_t end = std::min(begin + header->chunkSize, slotCount());
+                // A done chunk has been fully copied.
+                // Its slots only need retiring if the crash came before those writes reached persistent memory.
+                if (state == CHUNK_DONE)
+                {
+                    bool retired = true;
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        // Released memory stays released.
+                        if (pairs[i].value.load() == 0)
+                        {
+                            continue;
+                        }
+                        if ((Key)clearMark(pairs[i].key.load(), DirtyFlag) == KINITIAL)
+                        {
+                            pairs[i].key.store(KTOMBSTONE);
+                            retired = false;
+                        }
+                        if ((Value)clearMark(pairs[i].value.load(), DirtyFlag) != TOMBPRIME)
+                        {
+                            pairs[i].value.store(TOMBPRIME);
+                            retired = false;
+                        }
+                    }
+                    if (!retired)
+                    {
+                        PERSIST(&pairs[begin], sizeof(KVpair) * (end - begin));
+                    }
+                    chm.slots.fetch_add(end - begin);
+#ifdef RESIZE
+                    chm.copyDone.fetch_add(end - begin);
+#endif
+                    continue;
+                }
+                // A frozen chunk may be partially copied, so its marks must be restored before anything reads it.
+                // The marked pairs are then copied again as they are found, which is harmless for pairs that were already copied.
+                if (state == CHUNK_FROZEN)
+                {
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        freezeSlot(i);
+                    }
+                    PERSIST(&pairs[begin], sizeof(KVpair) * (end - begin));
+                }
+                for (size_t i = begin; i < end; i++)
+                {
+                    Key K = key(i);
+                    Value V = value(i);
+
+                    // If the key has been set but the value hasn't, then we have an incomplete insert on our hands.
+                    // The value is left initial rather than made a tombstone: the insert may have been the copy of a pair from an older table,
+                    // which has to be able to land here again when the older table is migrated after recovery.
+
+                    // Anything that's not a sentinel.
+                    if (V != VINITIAL && V != VTOMBSTONE && V != TOMBPRIME)
+                    {
+                        chm.size.fetch_add(1);
+                    }
+                    // Every claimed key counts towards the load of the table.
+                    if (K != KINITIAL)
+                    {
+                        chm.slots.fetch_add(1);
+                    }
+#ifdef RESIZE
+                    // Migrated slots still count towards finishing the migration.
+                    if (V == TOMBPRIME)
+                    {
+                        chm.copyDone.fetch_add(1);
+                    }
+#endif
+                }
+            }
+#ifdef RESIZE
+            chm.skipDoneChunks(this);
+#endif
+        }
+        // Check whether a migration out of a recovered table had started.
+        bool migrationStarted()
+        {
+            for (size_t chunk = 0; chunk < header->chunkCount; chunk++)
+            {
+                if (chunkState(chunk).load() != CHUNK_ACTIVE)
+                {
+                    return true;
+                }
+            }
+            for (size_t i = 0; i < slotCount(); i++)
+            {
+                if (isMarked((uintptr_t)value(i), MigrationFlag))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Check whether every value in a recovered table has been deleted or migrated.
+        bool migrationDone()
+        {
+            // A table migrated entirely in bulk needs no scan.
+            size_t chunk = 0;
+            while (chunk < header->chunkCount && chunkState(chunk).load() == CHUNK_DONE)
+            {
+                chunk++;
+            }
+            if (chunk == header->chunkCount)
+            {
+                return true;
+            }
+            for (size_t i = 0; i < slotCount(); i++)
+            {
+                Value val = value(i);
+                // If the value is a tombstone, initial value, or migrated.
+                // NOTE: If a migration was in progress (MigrationFlag is set for a valid value), then we consider migration incomplete as well.
+                if (val != VTOMBSTONE &&
+                    val != VINITIAL &&
+                    val != TOMBPRIME)
+                {
+                    // Migration did not complete.
+                    return false;
+                }
+            }
+            return true;
+        }
     };
 
     // Constructor.
-    ConcurrentHashMap(const char *fileDir, size_t size = Table::MIN_SIZE, bool reconstruct = true)
+    ConcurrentHashMap(const char *fileDir, size_t size = Table::MIN_SIZE, bool reconstruct = true, const MapOptions &options = MapOptions())
     {
+        // Without migrators, somebody has to help, or migrations never finish.
+        if (options.copyBudget == 0 && options.migrators == 0)
+        {
+            throw std::runtime_error("a copy budget of none needs migrator threads");
+        }
+        copyBudget = options.copyBudget;
+        if (!(options.loadFactor > 0 && options.loadFactor <= 1) || options.probeLimit == 0)
+        {
+            throw std::runtime_error("the load factor must be in (0, 1] and the probe limit positive");
+        }
+        loadFactor = options.loadFactor;
+        probeLimit = options.probeLimit;
+        if (!(options.growthFactor > 1))
+        {
+            throw std::runtime_error("the growth factor must be greater than 1");
+        }
+        growthFactor = options.growthFactor;
+        // A spare prepared at or past the load factor would never be ready in time.
+        if (options.preallocThreshold < 0 || (options.preallocThreshold > 0 && options.preallocThreshold >= loadFactor))
+        {
+            throw std::runtime_error("the preallocation threshold must be below the load factor");
+        }
+        releaseChunks = options.releaseChunks;
+        placement = options.placement;
+        tableDir = fileDir;
+        // Capacities are whole multiples of the minimum size.
+        size = (std::max(size, Table::MIN_SIZE) + Table::MIN_SIZE - 1) / Table::MIN_SIZE * Table::MIN_SIZE;
+        // Back every table with a single pool, if requested.
+        pool = options.poolPath.empty() ? nullptr : new TablePool(options.poolPath, options.poolSize);
+
         // Recovery.
         if (reconstruct)
         {
-            std::vector<std::string> tableNames;
             std::vector<Table *> tables;
-            std::string lastTableName;
 
-            // Get the table names.
-            std::filesystem::path path = fileDir;
-            for (auto &p : std::filesystem::directory_iterator(path))
+            // Tables in a pool are ordered by their recorded IDs.
+            if (pool != nullptr)
             {
-                const std::string filenameStr = p.path().filename().string();
-                if (p.is_regular_file())
+                size_t lastId = 0;
+                for (auto &allocation : pool->tables())
                 {
-                    tableNames.push_back(filenameStr);
+                    Table *table = new Table((TableHeader *)allocation.address, 0, allocation.id);
+                    table->recover();
+                    lastId = allocation.id;
+                    // If this table was fully migrated (or never used), give its extent back.
+                    if (table->migrationDone())
+                    {
+                        freeTable(table);
+                    }
+                    else
+                    {
+                        // Migration is incomplete. Add it to our list.
+                        tables.push_back(table);
+                    }
                 }
+                // Ensure we use unique IDs.
+                fileNameCounter.store(lastId + 1);
             }
-
-            // Sort the tables by name.
-            std::sort(tableNames.begin(), tableNames.end(),
-                      [](std::string a, std::string b)
-                      {
-                          return a.compare(b) < 0;
-                      });
-
-            // For each table.
-            // Map the table.
-            // Check if the table is empty or migrated.
-            for (auto it = tableNames.begin(); it != tableNames.end(); ++it)
+            else
             {
-                // Allocate an mmapped table.
-                Table *table = Table::mmapTable(!reconstruct, size, 0, (*it).c_str());
+                std::vector<std::string> tableNames;
+                std::string lastTableName;
 
-                // If the table is empty, deallocate it and continue.
-                if (table->chm.size.load() == 0)
+                // Get the table names.
+                std::filesystem::path path = fileDir;
+                for (auto &p : std::filesystem::directory_iterator(path))
                 {
-                    Table::munmapTable(table);
+                    const std::string filenameStr = p.path().string();
+                    if (p.is_regular_file())
+                    {
+                        tableNames.push_back(filenameStr);
+                    }
                 }
 
-                // If the table is fully migrated, deallocate it and continue.
-                bool migrationDone = true;
-                // Check for non-migrated values.
-                for (size_t i = 0; i < table->len; i++)
+                // Sort the tables by the number in their names.
+                std::sort(tableNames.begin(), tableNames.end(),
+                          [](std::string a, std::string b)
+                          {
+                              return Table::numFromName(a.c_str()) < Table::numFromName(b.c_str());
+                          });
+
+                // For each table.
+                // Map the table.
+                // Check if the table is empty or migrated.
+                for (auto it = tableNames.begin(); it != tableNames.end(); ++it)
                 {
-                    ValT val = table->value(i);
-                    // If the value is a tombstone, initial value, or migrated.
-                    if (val == VTOMBSTONE ||
-                        val == VINITIAL ||
-                        val == TOMBPRIME)
+                    // Map the existing table.
+                    Table *table = Table::mmapTable(tableDir, true, size, 0, (*it).c_str());
+
+                    // If this table was never formatted, fully migrated, or is empty.
+                    if (table == NULL || table->migrationDone())
                     {
-                        // Then migration for this value is complete.
-                        continue;
+                        // Deallocate it.
+                        if (table != NULL)
+                        {
+                            Table::munmapTable(table);
+                        }
+                        // Delete the underlying file.
+                        if (std::remove((*it).c_str()) != 0)
+                        {
+                            fprintf(stderr, "Error deleting file \"%s\". Error %d\n", (*it).c_str(), errno);
+                        }
                     }
-                    // Migration did not complete.
-                    // NOTE: If a migration was in progress (MigrationFlag is set for a valid value), then we consider migration incomplete as well.
                     else
                     {
-                        migrationDone = false;
-                        break;
-                    }
-                }
-                // If this table was fully migrated.
-                if (migrationDone)
-                {
-                    // Deallocate it.
-                    Table::munmapTable(table);
-                    // Delete the underlying file.
-                    if (std::remove((*it).c_str()) != 0)
-                    {
-                        fprintf(stderr, "Error deleting file \"%s\". Error %d\n", (*it).c_str(), errno);
+                        // Migration is incomplete. Add it to our list.
+                        tables.push_back(table);
                     }
+                    lastTableName = *it;
                 }
-                else
+                // Ensure we use unique file names.
+                if (!lastTableName.empty())
                 {
-                    // Migration is incomplete. Add it to our list.
-                    tables.push_back(table);
+                    fileNameCounter.store(Table::numFromName(lastTableName.c_str()) + 1);
                 }
-                lastTableName = *it;
+            }
+            // Nothing survived. Start over with an empty table.
+            if (tables.empty())
+            {
+                tables.push_back(allocTable(size, 0));
+            }
+            // A migration may have started before any pair reached its new table, which was then discarded as empty.
+            // Give the migration somewhere to go.
+            else if (tables.back()->migrationStarted())
+            {
+                Table *last = tables.back();
+                tables.push_back(allocTable(Table::CHM::newTableSize(last->len, growthFactor), 0));
             }
             // Now that tables are filtered out, perform migrations (or just link tables together).
             Table *oldTable = NULL;
@@ -851,26 +1759,52 @@ public:
 
                 if (oldTable != NULL)
                 {
-                    // Link the levels. This should always succeed, since we are running only one thread.
-                    bool CASSucceed = oldTable->chm.CASNewTable(newTable);
-                    assert(CASSucceed);
+                    // Link the levels. This always succeeds, since we are running only one thread.
+                    oldTable->chm.CASNewTable(newTable);
                 }
             }
             // Store the lowest table with an incomplete migration, as the base.
-            // Might as well not migrate during recovery, since we lose out on parallel migration performance.
+            // The migrations are finished in the background, so the map is usable right away.
             this->table.store(tables[0]);
-
-            // Ensure we use unique file names.
-            fileNameCounter.store(Table::numFromName(lastTableName.c_str()));
+#ifdef RESIZE
+            if (tables.size() > 1)
+            {
+                for (size_t i = 0; i < options.recoveryMigrators; i++)
+                {
+                    recoveryMigrators.emplace_back(&ConcurrentHashMap::drainRecovered, this);
+                }
+            }
+#endif
         }
         else
         {
             // Alternative approach: just make a table, bypassing recovery.
-            // Allocate a new, mmapped table.
-            Table *table = Table::mmapTable(!reconstruct, size, 0);
+            // Discard any tables an earlier map left in the pool.
+            if (pool != nullptr)
+            {
+                for (auto &allocation : pool->tables())
+                {
+                    pool->release(allocation.address);
+                }
+            }
+            // Allocate a new table.
+            Table *table = allocTable(size, 0);
             // Store the table.
             this->table.store(table);
         }
+
+        // Prepare tables ahead of resizes, if requested.
+        if (options.preallocThreshold > 0)
+        {
+            preallocator = std::thread(&ConcurrentHashMap::preallocate, this, options.preallocThreshold);
+        }
+#ifdef RESIZE
+        // Start the dedicated migrators, if requested.
+        for (size_t i = 0; i < options.migrators; i++)
+        {
+            migrators.emplace_back(&ConcurrentHashMap::migrate, this);
+        }
+#endif
         return;
     }
     // TODO: This filename isn't a given, especially since resizing could have more than one file at a time.
@@ -880,18 +1814,351 @@ public:
     }
     ~ConcurrentHashMap()
     {
-        // TODO: Unmap all mapped files, I guess.
-        Table *table = table.load();
-        // Unmap the file.
-        // TODO: What about the other files?
-        if (!munmapTable(table))
+        // Stop the background preallocator and migrators.
+        stopBackground.store(true);
+        if (preallocator.joinable())
+        {
+            preallocator.join();
+        }
+        migrationWakeup.notify_all();
+        for (std::thread &migrator : migrators)
         {
-            // Error.
-            fprintf(stderr, "Failed to unmap the file from memory.\n");
+            migrator.join();
         }
+        for (std::thread &migrator : recoveryMigrators)
+        {
+            migrator.join();
+        }
+        Table *spare = spareTable.exchange(nullptr);
+        if (spare != nullptr)
+        {
+            deleteTable(spare);
+        }
+        // Everything left in storage should be the chain the next recovery needs.
+        std::vector<size_t> stray = strayTables();
+        if (!stray.empty())
+        {
+            std::cerr << "Tables left outside the live chain:";
+            for (size_t id : stray)
+            {
+                std::cerr << " " << id;
+            }
+            std::cerr << std::endl;
+        }
+
+        // Unmap every table we can still reach.
+        // The tables stay on persistent memory for the next recovery.
+        Table *table = this->table.load();
+        while (table != nullptr)
+        {
+#ifdef RESIZE
+            Table *next = table->chm.newTable.load();
+#else
+            Table *next = nullptr;
+#endif
+            // Pool tables are unmapped along with the pool.
+            if (pool != nullptr)
+            {
+                delete table;
+            }
+            else if (Table::munmapTable(table))
+            {
+                // Error.
+                fprintf(stderr, "Failed to unmap the file from memory.\n");
+            }
+            table = next;
+        }
+        delete pool;
         return;
     }
 
+    // Allocate a new, initialized table.
+    // Tables come from the pool if there is one, or from a new file in the map's directory otherwise.
+    Table *allocTable(size_t tableCapacity, size_t existingSize)
+    {
+        if (pool == nullptr)
+        {
+            return Table::mmapTable(tableDir, false, tableCapacity, existingSize, NULL, placement);
+        }
+        // Using a shared counter means more contention, but guaranteed table ordering.
+        size_t count = fileNameCounter.fetch_add(1);
+        void *memory = pool->allocate(Table::bytes(tableCapacity));
+        if (memory == NULL)
+        {
+            throw std::runtime_error("table pool exhausted");
+        }
+        Table::place(memory, Table::bytes(tableCapacity), placement);
+        TableHeader *header = Table::format(memory, tableCapacity);
+        // The table only becomes visible to recovery once it is fully initialized.
+        pool->commit(header, count);
+        return new Table(header, existingSize, count);
+    }
+    // Release a table that is no longer needed.
+    void freeTable(Table *table)
+    {
+        if (pool == nullptr)
+        {
+            Table::munmapTable(table);
+            return;
+        }
+        pool->release(table->header);
+        delete table;
+    }
+    // Release a table and discard its contents, so recovery never sees it again.
+    void deleteTable(Table *table)
+    {
+        if (pool == nullptr)
+        {
+            std::string fileName = Table::getOrderedFileName(tableDir, table->chm.id);
+            Table::munmapTable(table);
+            std::remove(fileName.c_str());
+            return;
+        }
+        freeTable(table);
+    }
+    // Give up the storage of a fully migrated table, so recovery never reads it again.
+    // Other threads may still be reading the table, so it stays mapped:
+    // an unlinked file lives on until it is unmapped, and a retired pool extent is not reused while the pool is open.
+    void retireTable(Table *table)
+    {
+        if (pool != nullptr)
+        {
+            pool->retire(table->header);
+            return;
+        }
+        std::string fileName = Table::getOrderedFileName(tableDir, table->chm.id);
+        if (std::remove(fileName.c_str()) != 0)
+        {
+            fprintf(stderr, "Error deleting file \"%s\". Error %d\n", fileName.c_str(), errno);
+        }
+    }
+    // The IDs of tables in storage that are neither in the chain nor the spare.
+    // Recovery would have to read past them. Only meaningful while no table is being allocated.
+    std::vector<size_t> strayTables()
+    {
+        std::vector<size_t> live;
+        for (Table *t = table.load(); t != nullptr;)
+        {
+            live.push_back(t->chm.id);
+#ifdef RESIZE
+            t = t->chm.newTable.load();
+#else
+            t = nullptr;
+#endif
+        }
+        Table *spare = spareTable.load();
+        if (spare != nullptr)
+        {
+            live.push_back(spare->chm.id);
+        }
+        std::vector<size_t> stored;
+        if (pool != nullptr)
+        {
+            for (auto &allocation : pool->tables())
+            {
+                stored.push_back(allocation.id);
+            }
+        }
+        else
+        {
+            std::error_code error;
+            for (auto &p : std::filesystem::directory_iterator(tableDir, error))
+            {
+                if (p.is_regular_file())
+                {
+                    stored.push_back(Table::numFromName(p.path().c_str()));
+                }
+            }
+        }
+        std::vector<size_t> stray;
+        for (size_t id : stored)
+        {
+            if (std::find(live.begin(), live.end(), id) == live.end())
+            {
+                stray.push_back(id);
+            }
+        }
+        std::sort(stray.begin(), stray.end());
+        return stray;
+    }
+
+    // Take the spare table, if it can replace the given table with at least newSize slots.
+    // Returns nullptr if the table must be allocated inline.
+    Table *takeSpareTable(Table *table, size_t newSize, size_t existingSize)
+    {
+        Table *spare = spareTable.exchange(nullptr);
+        if (spare == nullptr)
+        {
+            return nullptr;
+        }
+        // Recovery links tables in ID order, so a table may only be replaced by a later one.
+        if (spare->len < newSize || spare->chm.id < table->chm.id)
+        {
+            deleteTable(spare);
+            return nullptr;
+        }
+        spare->chm.size.store(existingSize);
+        return spare;
+    }
+    // Keep an unused table as the spare, or delete it if there already is one.
+    void returnSpareTable(Table *table)
+    {
+        Table *expected = nullptr;
+        if (!spareTable.compare_exchange_strong(expected, table))
+        {
+            deleteTable(table);
+        }
+    }
+    // Background thread body.
+    // Watches the load of the top table and prepares its replacement before anyone has to resize.
+    void preallocate(double threshold)
+    {
+        while (!stopBackground.load())
+        {
+            Table *table = this->table.load();
+            // Only prepare a table once the soft threshold is crossed and no resize is underway.
+            // Claimed slots, like the resize trigger, rather than live pairs, which removes bring back down.
+            if (table->chm.slots.load() >= threshold * table->len
+#ifdef RESIZE
+                && table->chm.newTable.load() == nullptr
+#endif
+            )
+            {
+                size_t newSize = Table::CHM::newTableSize(table->len, growthFactor);
+                // Replace a spare that has become too small.
+                Table *spare = spareTable.load();
+                if (spare != nullptr && spare->len < newSize &&
+                    spareTable.compare_exchange_strong(spare, nullptr))
+                {
+                    deleteTable(spare);
+                    spare = nullptr;
+                }
+                if (spare == nullptr)
+                {
+                    returnSpareTable(allocTable(newSize, 0));
+                }
+            }
+            std::this_thread::sleep_for(PREALLOC_INTERVAL);
+        }
+    }
+
+    // Rewrite the whole chain of tables into a single table sized for the live pairs at the target load factor.
+    // Meant for a map no other thread is using, such as one just recovered by an offline tool.
+    // The old tables are deleted only once the new table is durable in the map's own directory,
+    // and until they are gone recovery treats the new table as their migration target.
+    // Returns the number of live pairs.
+    size_t compact(size_t threads = std::thread::hardware_concurrency())
+    {
+        threads = std::max(threads, (size_t)1);
+#ifdef RESIZE
+        // Finish any migrations first, so that every live pair is in the top table.
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < threads; i++)
+        {
+            workers.emplace_back(&ConcurrentHashMap::drainRecovered, this);
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+#endif
+        Table *oldTable = table.load();
+        size_t chunkSize = oldTable->header->chunkSize;
+        size_t chunkCount = oldTable->header->chunkCount;
+        // Run a function over every live pair of the old table, on every thread.
+        auto forLive = [&](auto visit)
+        {
+            std::atomic<size_t> nextChunk{0};
+            std::vector<std::thread> workers;
+            for (size_t i = 0; i < threads; i++)
+            {
+                workers.emplace_back([&]()
+                                     {
+                                         for (size_t chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1))
+                                         {
+                                             size_t end = std::min((chunk + 1) * chunkSize, oldTable->slotCount());
+                                             for (size_t idx = chunk * chunkSize; idx < end; idx++)
+                                             {
+                                                 Value V = oldTable->value(idx);
+                                                 if (V != VINITIAL && V != VTOMBSTONE && V != TOMBPRIME)
+                                                 {
+                                                     visit(oldTable->key(idx), V);
+                                                 }
+                                             }
+                                         }
+                                         // Make this thread's copies durable.
+                                         PERSIST_BARRIER_ONLY();
+                                     });
+            }
+            for (std::thread &worker : workers)
+            {
+                worker.join();
+            }
+        };
+
+        std::atomic<size_t> live{0};
+        forLive([&](Key, Value)
+                { live.fetch_add(1); });
+        size_t capacity = (size_t)(live.load() / loadFactor) + 1;
+        capacity = (std::max(capacity, Table::MIN_SIZE) + Table::MIN_SIZE - 1) / Table::MIN_SIZE * Table::MIN_SIZE;
+
+        Table *newTable;
+        while (true)
+        {
+            newTable = allocTable(capacity, live.load());
+            forLive([&](Key key, Value value)
+                    { copyPair(newTable, key, value); });
+#ifdef RESIZE
+            // An unlucky distribution may overflow the stash, which resizes the new table. Start over with a larger one.
+            if (newTable->chm.newTable.load() != nullptr)
+            {
+                while (newTable != nullptr)
+                {
+                    Table *next = newTable->chm.newTable.load();
+                    deleteTable(newTable);
+                    newTable = next;
+                }
+                capacity = Table::CHM::newTableSize(capacity, growthFactor);
+                continue;
+            }
+#endif
+            break;
+        }
+        newTable->chm.size.store(live.load());
+
+        // The new table is durable, so the old ones can go.
+        table.store(newTable);
+        if (pool != nullptr)
+        {
+            for (auto &allocation : pool->tables())
+            {
+                if (allocation.id != newTable->chm.id)
+                {
+                    pool->release(allocation.address);
+                }
+            }
+            delete oldTable;
+        }
+        else
+        {
+            // Deleting the old tables is only safe if the new one is where the next recovery will look.
+            std::string newFile = Table::getOrderedFileName(tableDir, newTable->chm.id);
+            if (!std::filesystem::is_regular_file(newFile))
+            {
+                throw std::runtime_error("the compacted table is not in " + tableDir + ", so the old tables were kept");
+            }
+            Table::munmapTable(oldTable);
+            for (auto &p : std::filesystem::directory_iterator(tableDir))
+            {
+                if (p.is_regular_file() && Table::numFromName(p.path().c_str()) != newTable->chm.id)
+                {
+                    std::filesystem::remove(p.path());
+                }
+            }
+        }
+        return live.load();
+    }
+
     // This number is really only meaningful if the size is not being changed by other threads.
     size_t size()
     {
@@ -927,6 +2194,12 @@ public:
     {
         return (putIfMatch(key, newValue, oldValue) == oldValue);
     }
+    // Replace the value of a key only if it is present. An absent key stays absent, and claims no slot.
+    // Returns the value replaced, or VINITIAL if the key was absent.
+    Value replace(Key key, Value newValue)
+    {
+        return putIfMatch(key, newValue, MATCH_ANY);
+    }
     // Accept an arbitrary function to replace the use of standard CAS.
     // Enables more complex logic by allowing the new value to adapt based on the actual old value.
     Value update(Key key, Value value, Value function(Table *table, size_t idx, Value oldValue, Value newValue))
@@ -938,7 +2211,11 @@ public:
     {
         assert(newVal != VINITIAL);
         assert(oldVal != VINITIAL);
-        Value retVal = putIfMatch(table.load(), key, newVal, oldVal, CAS);
+        opCopyBudget = copyBudget;
+        size_t probes = 0;
+        Value retVal = putIfMatch(table.load(), key, newVal, oldVal, probes, CAS);
+        statistics.add(MapCounter::WRITES);
+        statistics.add(MapCounter::WRITE_PROBES, probes);
         assert(!isMarked(retVal, MigrationFlag));
         return retVal == VTOMBSTONE ? VINITIAL : retVal;
     }
@@ -956,14 +2233,65 @@ public:
         return K == key;
     }
 
+    // Find a key in the stash of a table, claiming a free slot for it if asked to.
+    // Returns NO_SLOT if the key is not there. open is then set if the stash has room, which means the key is in no other table either.
+    size_t stashSlot(Table *table, Key key, bool claim, bool &open)
+    {
+        open = false;
+        for (size_t idx = table->len; idx < table->slotCount(); idx++)
+        {
+            Key K = table->key(idx);
+            // Stash slots are claimed in order, so the first free one ends the search.
+            if (K == KINITIAL)
+            {
+                if (!claim)
+                {
+                    open = true;
+                    return NO_SLOT;
+                }
+                K = table->CASkey(idx, KINITIAL, key);
+                if (K == KINITIAL)
+                {
+                    table->chm.slots.fetch_add(1);
+                    return idx;
+                }
+                statistics.casFailed(CasSite::KEY_CLAIM);
+            }
+            if (keyEq(K, key))
+            {
+                return idx;
+            }
+            // A frozen stash takes no more keys.
+            if (K == KTOMBSTONE)
+            {
+                break;
+            }
+        }
+        return NO_SLOT;
+    }
+
+    // The hash of a key, mixed so that its high bits are as good as its low ones.
+    // Range reduction uses the high bits, and hashes like std::hash are often the identity.
+    static size_t hashKey(Key key)
+    {
+        // The MurmurHash3 finalizer.
+        size_t hash = Hash{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
     // Heavy lifting for user-facing get value from key.
-    Value getImpl(Table *table, Key key, int fullHash)
+    // Adds the number of slots read to probes.
+    Value getImpl(Table *table, Key key, size_t hash, size_t &probes)
     {
         // The capacity of the table.
         size_t len = table->len;
-        // The hash of the key.
-        // Truncated to keep within the boundaries of the key range.
-        size_t idx = fullHash & (len - 1);
+        // The home slot of the key.
+        size_t idx = table->home(hash);
 
         // Probe loop.
         // Keep searching until the key is found or we have exceeded the probe bounds.
@@ -972,6 +2300,15 @@ public:
         {
             // Probe the table.
             // NOTE: These are atomic reads. We must carefully adjust this if we want to support relocating keys.
+            probes++;
+            if constexpr (Stats::ENABLED)
+            {
+                // The reads below persist whatever they find unpersisted.
+                if (isMarked(table->pairs[idx].key.load(), DirtyFlag) || isMarked(table->pairs[idx].value.load(), DirtyFlag))
+                {
+                    statistics.add(MapCounter::READER_FLUSHES);
+                }
+            }
             Key K = table->key(idx);
             Value V = table->value(idx);
 
@@ -1000,19 +2337,35 @@ public:
 
                 // Key may only be partially copied.
                 // Finish the copy and retry.
-                return getImpl(table->chm.copySlotAndCheck(this, table, idx, key == KINITIAL), key, fullHash);
+                return getImpl(table->chm.copySlotAndCheck(this, table, idx, key == KINITIAL), key, hash, probes);
 #else
                 return (V == VTOMBSTONE) ? VINITIAL : V;
 #endif
             }
 
+            // Keys that reached the reprobe limit live in the stash.
+            if (++reprobeCount >= reprobeLimit(len) && K != KTOMBSTONE && idx < len)
+            {
+                bool open = false;
+                size_t slot = stashSlot(table, key, false, open);
+                if (slot != NO_SLOT)
+                {
+                    // Read the pair on the next pass.
+                    idx = slot;
+                    continue;
+                }
+                if (open)
+                {
+                    return VINITIAL;
+                }
+            }
             // If we have exceeded our reprobe limit.
-            if (++reprobeCount >= reprobeLimit(len) ||
+            if (reprobeCount >= reprobeLimit(len) ||
                 // Or if we found a tombstone key, indicating there are no more keys in this table.
                 K == KTOMBSTONE)
             {
 #ifdef RESIZE
-                return (newTable == nullptr) ? VINITIAL : getImpl(helpCopy(newTable), key, fullHash);
+                return (newTable == nullptr) ? VINITIAL : getImpl(helpCopy(newTable), key, hash, probes);
 #else
                 // Value is not present.
                 return VINITIAL;
@@ -1020,7 +2373,7 @@ public:
             }
 
             // Probe to the next index.
-            idx = (idx + 1) & (len - 1);
+            idx = table->next(idx);
         }
     }
 
@@ -1028,9 +2381,21 @@ public:
     Value get(Key key)
     {
         // The hash of the key determines the target index.
-        size_t fullhash = Hash{}(key);
+        size_t hash = hashKey(key);
         // Get the value associated with the key.
-        Value V = getImpl(table, key, fullhash);
+        opCopyBudget = copyBudget;
+        size_t probes = 0;
+        Value V = getImpl(table, key, hash, probes);
+        if (V == VINITIAL)
+        {
+            statistics.add(MapCounter::LOOKUP_MISSES);
+            statistics.add(MapCounter::LOOKUP_MISS_PROBES, probes);
+        }
+        else
+        {
+            statistics.add(MapCounter::LOOKUP_HITS);
+            statistics.add(MapCounter::LOOKUP_HIT_PROBES, probes);
+        }
         // We should never return a value that is mid-migration.
         assert(!isMarked((uintptr_t)V, MigrationFlag));
         // Return the associated value.
@@ -1039,7 +2404,8 @@ public:
 
     // Called by most put functions. This one does the heavy lifting.
     // This accepts custom conditional CAS functions.
-    Value putIfMatch(Table *table, Key key, Value newVal, Value oldVal,
+    // Adds the number of slots read to probes.
+    Value putIfMatch(Table *table, Key key, Value newVal, Value oldVal, size_t &probes,
                      Value CAS(Table *table, size_t idx, Value oldValue, Value newValue) = &Table::CASvalue)
     {
         // It's not appropriate to set a value back to an initial, unset state.
@@ -1050,9 +2416,8 @@ public:
 
         // The capacity of the table.
         size_t len = table->len;
-        // The hash of the key.
-        // Truncated to keep within the boundaries of the key range.
-        size_t idx = Hash{}(key) & (len - 1);
+        // The home slot of the key.
+        size_t idx = table->home(hashKey(key));
 
         // Keep track of how far we linearly probe.
         size_t reprobeCount = 0;
@@ -1063,10 +2428,13 @@ public:
         // Prepare a new table, as needed.
         Table *newTable = nullptr;
 #endif
+        // Removals and replacements only change a key that is present, so they never claim a slot.
+        const bool presentOnly = newVal == VTOMBSTONE || oldVal == MATCH_ANY;
         // Spin until we get a key slot.
         while (true)
         {
             // Get the key and value in the current slot.
+            probes++;
             K = table->key(idx);
             V = table->value(idx);
 
@@ -1075,11 +2443,11 @@ public:
             {
                 // If we find an empty slot, the key was never in the table.
 
-                // If we were trying to remove the key.
-                if (newVal == ConcurrentHashMap<Key, Value, Hash>::VTOMBSTONE)
+                // If we were trying to remove or replace the key.
+                if (presentOnly)
                 {
                     // We don't need to do anything.
-                    return newVal;
+                    return VTOMBSTONE;
                 }
 
                 // Claim the unused key slot.
@@ -1094,6 +2462,7 @@ public:
                 // CAS failed. May need to try again.
                 else
                 {
+                    statistics.casFailed(CasSite::KEY_CLAIM);
                     // Update the expected key with what was actually found during the CAS.
                     K = actualKey;
                 }
@@ -1106,8 +2475,25 @@ public:
                 break;
             }
 
-            // If we probe too far.
-            if (++reprobeCount >= reprobeLimit(len) ||
+            // If we probe too far, fall back to the stash.
+            if (++reprobeCount >= reprobeLimit(len) && K != KTOMBSTONE)
+            {
+                bool open = false;
+                size_t slot = stashSlot(table, key, !presentOnly, open);
+                if (slot != NO_SLOT)
+                {
+                    idx = slot;
+                    V = table->value(idx);
+                    break;
+                }
+                // The key was never in the table, so there is nothing to remove or replace.
+                if (open)
+                {
+                    return VTOMBSTONE;
+                }
+            }
+            // If the stash is full too.
+            if (reprobeCount >= reprobeLimit(len) ||
                 // Or if we run out of space.
                 K == KTOMBSTONE)
             {
@@ -1125,14 +2511,14 @@ public:
                 }
                 // Try again in the new table.
                 // This is a recursive call.
-                return putIfMatch(newTable, key, newVal, oldVal);
+                return putIfMatch(newTable, key, newVal, oldVal, probes, CAS);
 #else
                 // The key is not present.
                 return VINITIAL;
 #endif
             }
             // Reprobe.
-            idx = (idx + 1) & (len - 1);
+            idx = table->next(idx);
         }
         // Now we have a key slot.
 
@@ -1144,11 +2530,18 @@ public:
         }
 
 #ifdef RESIZE
+        // Values are never placed into a table that is being migrated, only into the newest table.
+        // Placing them here would just mean copying them again, possibly more than once if the chain of tables is long.
+        // The claimed key slot stays behind, marked, so readers know to look further.
+        if (newTable == nullptr)
+        {
+            newTable = table->chm.newTable.load();
+        }
         // Consider allocating a newer table for placement.
         // If a new table hasn't already been allocated.
         if (newTable == nullptr &&
-            // And we are doing a fresh key insert while the table is nearly full.
-            ((V == VINITIAL && table->chm.tableFull(reprobeCount, len)) ||
+            // And we are doing a fresh key insert while the table is nearly full, or has started to fill its stash.
+            ((V == VINITIAL && (table->chm.tableFull(len, loadFactor) || idx >= len + table->stashLen / 2)) ||
              // Or our value is marked.
              isMarked((uintptr_t)V, MigrationFlag)))
         {
@@ -1161,7 +2554,7 @@ public:
         {
             // Copy the slot and retry in the new table.
             // This is a recursive call to the new table.
-            return this->putIfMatch(table->chm.copySlotAndCheck(this, table, idx, oldVal == VINITIAL), key, newVal, oldVal);
+            return this->putIfMatch(table->chm.copySlotAndCheck(this, table, idx, oldVal == VINITIAL), key, newVal, oldVal, probes, CAS);
         }
 #endif
         // Update the existing table.
@@ -1215,6 +2608,7 @@ public:
             // CAS failed.
             else
             {
+                statistics.casFailed(CasSite::VALUE_UPDATE);
                 // Update the value with what we found during the failed CAS.
                 V = actualValue;
             }
@@ -1222,13 +2616,73 @@ public:
             // If a primed value was is present (placed by us or someone else), re-run put on the new table.
             if (isMarked((uintptr_t)table->value(idx), MigrationFlag))
             {
-                return putIfMatch(table->chm.copySlotAndCheck(this, table, idx, oldVal == VINITIAL), key, newVal, oldVal);
+                return putIfMatch(table->chm.copySlotAndCheck(this, table, idx, oldVal == VINITIAL), key, newVal, oldVal, probes, CAS);
             }
 #endif
             // Otherwise retry our put.
         }
     }
 #ifdef RESIZE
+    // Copy a pair from a bulk migrated chunk into a table, unless the key already has a value there.
+    // Writes here are not persisted. They are flushed, and the caller fences once for the whole chunk.
+    // Falls back to putIfMatch if the table is full or is being migrated itself.
+    void copyPair(Table *table, Key key, Value val)
+    {
+        size_t len = table->len;
+        size_t idx = table->home(hashKey(key));
+        for (size_t reprobeCount = 0; reprobeCount < reprobeLimit(len); reprobeCount++)
+        {
+            KVpair *pair = &table->pairs[idx];
+            // Claim the key slot if it is free.
+            Key K = pair->key.load();
+            while ((Key)clearMark(K, DirtyFlag) == KINITIAL)
+            {
+                if (pair->key.compare_exchange_strong(K, key))
+                {
+                    table->chm.slots.fetch_add(1);
+                    K = key;
+                }
+                else
+                {
+                    statistics.casFailed(CasSite::COPY_PAIR);
+                }
+            }
+            K = (Key)clearMark(K, DirtyFlag);
+            if (K == KTOMBSTONE)
+            {
+                break;
+            }
+            if (keyEq(K, key))
+            {
+                // If this table is being migrated too, the pair belongs in the newest table.
+                if (table->chm.newTable.load() != nullptr)
+                {
+                    break;
+                }
+                Value V = pair->value.load();
+                while ((Value)clearMark(V, DirtyFlag) == VINITIAL)
+                {
+                    if (pair->value.compare_exchange_strong(V, val))
+                    {
+                        PERSIST_FLUSH_ONLY(pair, sizeof(KVpair));
+                        statistics.add(MapCounter::SLOTS_COPIED);
+                        return;
+                    }
+                    statistics.casFailed(CasSite::COPY_PAIR);
+                }
+                // The slot is being migrated, so the copy has to follow it.
+                if (isMarked(V, MigrationFlag))
+                {
+                    break;
+                }
+                // Some value is already there, which supersedes ours.
+                return;
+            }
+            idx = table->next(idx);
+        }
+        size_t probes = 0;
+        putIfMatch(table, key, val, VINITIAL, probes);
+    }
     // Help to perform table migration, likely being assigned some range of values.
     // TODO: I have decided to assume the helper is always the top level table. This may not always be true.
     Table *helpCopy(Table *helper)
@@ -1236,74 +2690,315 @@ public:
         Table *topTable = this->table.load();
 
         // If there is no copy in progress, then there's nothing to be done here.
-        if (topTable->chm.newTable.load() == nullptr)
+        Table *newTable = topTable->chm.newTable.load();
+        if (newTable == nullptr)
+        {
+            return helper;
+        }
+        // Leave the copy to the dedicated migrators, unless they are falling behind.
+        // They are behind if the new table already needs replacing before the old one is drained.
+        if (!migrators.empty() && newTable->chm.newTable.load() == nullptr)
+        {
+            return helper;
+        }
+        // Operations may be barred from helping at all, or have spent their budget earlier in the operation.
+        if (opCopyBudget == 0)
         {
             return helper;
         }
-        topTable->chm.helpCopyImpl(this, topTable, false);
+        int64_t start = steadyNanos();
+        opCopyBudget -= topTable->chm.helpCopyImpl(this, topTable, opCopyBudget);
+        counters.helperNanos.fetch_add(steadyNanos() - start);
         return helper;
     }
+    // The table operations start from.
+    Table *currentTable()
+    {
+        return table.load();
+    }
+    // Copy one chunk of the current table into its replacement, starting a migration if there is none.
+    // Helpers copy chunks in the order they claim them. This lets a test pick the order instead.
+    void migrateChunk(size_t chunk)
+    {
+        Table *topTable = this->table.load();
+        topTable->chm.resize(this, topTable);
+        topTable->chm.migrateChunk(this, topTable, chunk);
+    }
+    // Wake the migrator threads, if any, to work on a new migration.
+    void wakeMigrators()
+    {
+        if (!migrators.empty())
+        {
+            migrationWakeup.notify_all();
+        }
+    }
+    // Migrator thread body.
+    // Drains migrations out of the top table as soon as they start.
+    void migrate()
+    {
+        while (!stopBackground.load())
+        {
+            Table *topTable = this->table.load();
+            if (topTable->chm.newTable.load() != nullptr)
+            {
+                int64_t start = steadyNanos();
+                topTable->chm.helpCopyImpl(this, topTable, UNLIMITED_COPY_BUDGET);
+                counters.migratorNanos.fetch_add(steadyNanos() - start);
+                continue;
+            }
+            // Sleep until a resize starts.
+            std::unique_lock<std::mutex> guard(migrationLock);
+            migrationWakeup.wait_for(guard, MIGRATOR_IDLE);
+        }
+    }
+    // Recovery migrator thread body.
+    // Drains the chain of tables left by a crash, then exits.
+    void drainRecovered()
+    {
+        while (!stopBackground.load())
+        {
+            Table *topTable = this->table.load();
+            if (topTable->chm.newTable.load() == nullptr)
+            {
+                return;
+            }
+            int64_t start = steadyNanos();
+            topTable->chm.helpCopyImpl(this, topTable, UNLIMITED_COPY_BUDGET);
+            counters.migratorNanos.fetch_add(steadyNanos() - start);
+        }
+    }
 #endif
+    // A snapshot of the migration counters.
+    MigrationMetrics migrationMetrics()
+    {
+        MigrationMetrics metrics;
+        metrics.migrations = counters.migrations.load();
+        metrics.bytes = counters.bytes.load();
+        metrics.migrationSeconds = counters.migrationNanos.load() / 1e9;
+        metrics.helperSeconds = counters.helperNanos.load() / 1e9;
+        metrics.migratorSeconds = counters.migratorNanos.load() / 1e9;
+        metrics.releasedBytes = counters.releasedBytes.load();
+        return metrics;
+    }
+    // A snapshot of the runtime statistics, summed over threads.
+    // Only the table chain depth and help time are known unless the map was built with a counting policy.
+    MapStats stats()
+    {
+        MapStats stats;
+        statistics.collect(stats);
+        stats.helpSeconds = counters.helperNanos.load() / 1e9;
+        for (Table *t = table.load(); t != nullptr;)
+        {
+            stats.chainDepth++;
+#ifdef RESIZE
+            t = t->chm.newTable.load();
+#else
+            t = nullptr;
+#endif
+        }
+        return stats;
+    }
     // Pretty-printing for Value sentinels.
-    void printValue(Value val, std::ostream stream = std::cout)
+    static void printValue(Value val, std::ostream &stream = std::cout)
     {
-        switch (val)
+        if (val == VINITIAL)
         {
-        case VINITIAL:
             stream << "VINITIAL";
-            break;
-        case VTOMBSTONE:
+        }
+        else if (val == VTOMBSTONE)
+        {
             stream << "VTOMBSTONE";
-            break;
-        case TOMBPRIME:
+        }
+        else if (val == TOMBPRIME)
+        {
             stream << "TOMBPRIME";
-            break;
-        case MATCH_ANY:
+        }
+        else if (val == MATCH_ANY)
+        {
             stream << "MATCH_ANY";
-            break;
-        case NO_MATCH_OLD:
+        }
+        else if (val == NO_MATCH_OLD)
+        {
             stream << "NO_MATCH_OLD";
-            break;
-        default:
+        }
+        else if (isMarked((uintptr_t)val, MigrationFlag))
+        {
+            stream << (Value)clearMark((uintptr_t)val, MigrationFlag) << " (migrating)";
+        }
+        else
+        {
             stream << val;
-            break;
         }
     }
     // Pretty-printing for Key sentinels.
-    void printKey(Key key, std::ostream stream = std::cout)
+    static void printKey(Key key, std::ostream &stream = std::cout)
     {
-        switch (key)
+        if (key == KINITIAL)
         {
-        case KINITIAL:
             stream << "KINITIAL";
-            break;
-        case KTOMBSTONE:
+        }
+        else if (key == KTOMBSTONE)
+        {
             stream << "KTOMBSTONE";
-            break;
-        default:
+        }
+        else
+        {
             stream << key;
-            break;
         }
     }
-    // Print out the table contents.
-    // Used for debugging.
-    std::ostream print(Table *topTable = NULL)
+    // Print out the table contents, stash included.
+    // Used for debugging. See inspect() for a summary of a large table.
+    void print(std::ostream &output = std::cout, Table *topTable = NULL)
     {
-        std::ostream output;
         if (topTable == NULL)
         {
             topTable = table.load();
         }
-        size_t len = topTable->len;
-        for (size_t i = 0; i < len; i++)
+        for (size_t i = 0; i < topTable->slotCount(); i++)
         {
-
-            Key key = topTable->key(i);
-            Value value = topTable->value(i);
-            output << "key: " << printKey(key) << "value: " << printValue(value) << "\n";
+            output << i << ": key: ";
+            printKey(topTable->key(i), output);
+            output << ", value: ";
+            printValue(topTable->value(i), output);
+            output << "\n";
         }
         output << std::endl;
-        return output;
+    }
+    // Summarize the layout of a formatted table, on the given number of threads.
+    // Only reads the table, so it may be mapped read-only. Must not be used on a table that is changing.
+    static TableReport inspect(const TableHeader *header, size_t threads = std::thread::hardware_concurrency())
+    {
+        const KVpair *pairs = ((TableHeader *)header)->pairs();
+        size_t len = header->capacity;
+        threads = std::max(std::min(threads, len / Table::MIN_SIZE), (size_t)1);
+        auto keyAt = [&](size_t idx)
+        {
+            return (Key)clearMark(pairs[idx].key.load(), DirtyFlag);
+        };
+
+        TableReport report;
+        report.capacity = len;
+        report.stashSize = header->stashSize;
+        for (size_t chunk = 0; chunk < header->chunkCount; chunk++)
+        {
+            uint64_t state = ((TableHeader *)header)->chunks()[chunk].load();
+            (state == CHUNK_DONE ? report.doneChunks : state == CHUNK_FROZEN ? report.frozenChunks : report.activeChunks)++;
+        }
+
+        // Clusters are only split at empty slots, so each thread starts at the first empty slot of its part.
+        // Parts are laid out from an empty slot, so no cluster wraps around the end of the table.
+        size_t origin = 0;
+        while (origin < len && keyAt(origin) != KINITIAL)
+        {
+            origin++;
+        }
+        if (origin == len)
+        {
+            // Every slot is taken. The whole table is one cluster.
+            origin = 0;
+            threads = 1;
+        }
+        std::vector<size_t> starts(threads + 1, len);
+        for (size_t t = 0; t < threads; t++)
+        {
+            size_t start = len * t / threads;
+            while (t > 0 && start < len && keyAt((origin + start) % len) != KINITIAL)
+            {
+                start++;
+            }
+            starts[t] = std::max(start, t > 0 ? starts[t - 1] : 0);
+        }
+
+        std::vector<TableReport> parts(threads);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; t++)
+        {
+            workers.emplace_back([&, t]()
+                                 {
+                                     TableReport &part = parts[t];
+                                     size_t run = 0;
+                                     for (size_t offset = starts[t]; offset <= starts[t + 1]; offset++)
+                                     {
+                                         size_t idx = (origin + offset) % len;
+                                         Key K = offset < starts[t + 1] ? keyAt(idx) : KINITIAL;
+                                         // Released memory reads as zero. It holds no keys, so it ends a cluster too.
+                                         if (K == 0)
+                                         {
+                                             part.released++;
+                                         }
+                                         // An empty slot ends a cluster, and a lookup from it probes just the one slot.
+                                         if (K == KINITIAL || K == 0)
+                                         {
+                                             if (run > 0)
+                                             {
+                                                 part.addCluster(run, (idx + len - run) % len);
+                                                 part.totalMissProbes += run * (run + 1) / 2 + run;
+                                             }
+                                             part.totalMissProbes += offset < starts[t + 1] ? 1 : 0;
+                                             run = 0;
+                                             continue;
+                                         }
+                                         run++;
+                                         part.keys++;
+                                         if (K == KTOMBSTONE)
+                                         {
+                                             continue;
+                                         }
+                                         size_t displacement = (idx + len - Table::reduce(hashKey(K), len)) % len;
+                                         part.totalDisplacement += displacement;
+                                         part.maxDisplacement = std::max(part.maxDisplacement, displacement);
+                                         part.probes[63 - __builtin_clzll(displacement + 1)]++;
+                                     }
+                                 });
+        }
+        for (std::thread &worker : workers)
+        {
+            worker.join();
+        }
+        for (TableReport &part : parts)
+        {
+            report.merge(part);
+        }
+
+        for (size_t idx = len; idx < len + header->stashSize; idx++)
+        {
+            Key K = keyAt(idx);
+            if (K == 0)
+            {
+                report.released++;
+            }
+            else if (K != KINITIAL)
+            {
+                report.keys++;
+                report.stashKeys++;
+            }
+        }
+        // Values are tallied in one pass over every slot.
+        for (size_t idx = 0; idx < len + header->stashSize; idx++)
+        {
+            Value V = (Value)clearMark(pairs[idx].value.load(), DirtyFlag);
+            if (keyAt(idx) == 0)
+            {
+                continue;
+            }
+            if (V == TOMBPRIME)
+            {
+                report.migrated++;
+            }
+            else if (isMarked((uintptr_t)V, MigrationFlag))
+            {
+                report.frozen++;
+            }
+            else if (V == VTOMBSTONE)
+            {
+                report.tombstones++;
+            }
+            else if (V != VINITIAL)
+            {
+                report.live++;
+            }
+        }
+        return report;
     }
 
     // Reports whether or not this key can be used.
@@ -1322,6 +3017,49 @@ public:
 private:
     // The structure that stores the top table.
     std::atomic<Table *> table;
+    // Backing storage for all tables, or nullptr for one file per table.
+    TablePool *pool;
+    // A table allocated ahead of time, ready for the next resize.
+    std::atomic<Table *> spareTable{nullptr};
+    // Background thread that fills in the spare table.
+    std::thread preallocator;
+    // Tells background threads to exit.
+    std::atomic<bool> stopBackground{false};
+    // Dedicated migrator threads.
+    std::vector<std::thread> migrators;
+    // Threads finishing the migrations left by a crash.
+    std::vector<std::thread> recoveryMigrators;
+    // Chunks of migration work a single operation may take on. See MapOptions.
+    size_t copyBudget;
+    // Chunks the current operation of this thread may still take on.
+    // Set from copyBudget as each operation starts, so every helpCopy within one operation draws on the same budget.
+    // Migration threads never set it, so the copies they make never help any further.
+    static inline thread_local size_t opCopyBudget = 0;
+    // Whether to release migrated chunks. See MapOptions.
+    bool releaseChunks;
+    // The directory holding the table files, when there is no pool.
+    std::string tableDir;
+    // Placement of new tables' pages. See MapOptions.
+    PagePlacement placement;
+    // Resize and probe policy. See MapOptions.
+    double loadFactor;
+    size_t probeLimit;
+    double growthFactor;
+    // Wakes idle migrators when a resize starts.
+    std::mutex migrationLock;
+    std::condition_variable migrationWakeup;
+    // Raw migration counters. See MigrationMetrics.
+    struct
+    {
+        std::atomic<size_t> migrations{0};
+        std::atomic<size_t> bytes{0};
+        std::atomic<int64_t> migrationNanos{0};
+        std::atomic<int64_t> helperNanos{0};
+        std::atomic<int64_t> migratorNanos{0};
+        std::atomic<size_t> releasedBytes{0};
+    } counters;
+    // Runtime statistics. Takes no space with a policy that counts nothing.
+    [[no_unique_address]] Stats statistics;
 };
 
 // size_t keys and values.
@@ -1346,20 +3084,20 @@ private:
 // size_t keys and values.
 // Initialization of sentinels.
 // Values are static.
-template <typename Key, typename Value, class Hash>
-Value ConcurrentHashMap<Key, Value, Hash>::VINITIAL = ((((size_t)1 << 62) - 1) << BITS_MARKED);
-template <typename Key, typename Value, class Hash>
-Value ConcurrentHashMap<Key, Value, Hash>::VTOMBSTONE = ((((size_t)1 << 62) - 2) << BITS_MARKED);
-template <typename Key, typename Value, class Hash>
-Value ConcurrentHashMap<Key, Value, Hash>::TOMBPRIME = (size_t)setMark(VTOMBSTONE, MigrationFlag);
-template <typename Key, typename Value, class Hash>
-Value ConcurrentHashMap<Key, Value, Hash>::MATCH_ANY = ((((size_t)1 << 62) - 3) << BITS_MARKED);
-template <typename Key, typename Value, class Hash>
-Value ConcurrentHashMap<Key, Value, Hash>::NO_MATCH_OLD = ((((size_t)1 << 62) - 4) << BITS_MARKED);
-
-template <typename Key, typename Value, class Hash>
-Key ConcurrentHashMap<Key, Value, Hash>::KINITIAL = ((((size_t)1 << 62) - 1) << BITS_MARKED);
-template <typename Key, typename Value, class Hash>
-Key ConcurrentHashMap<Key, Value, Hash>::KTOMBSTONE = ((((size_t)1 << 62) - 2) << BITS_MARKED);
+template <typename Key, typename Value, class Hash, class Stats>
+Value ConcurrentHashMap<Key, Value, Hash, Stats>::VINITIAL = ((((size_t)1 << 62) - 1) << BITS_MARKED);
+template <typename Key, typename Value, class Hash, class Stats>
+Value ConcurrentHashMap<Key, Value, Hash, Stats>::VTOMBSTONE = ((((size_t)1 << 62) - 2) << BITS_MARKED);
+template <typename Key, typename Value, class Hash, class Stats>
+Value ConcurrentHashMap<Key, Value, Hash, Stats>::TOMBPRIME = (size_t)setMark(VTOMBSTONE, MigrationFlag);
+template <typename Key, typename Value, class Hash, class Stats>
+Value ConcurrentHashMap<Key, Value, Hash, Stats>::MATCH_ANY = ((((size_t)1 << 62) - 3) << BITS_MARKED);
+template <typename Key, typename Value, class Hash, class Stats>
+Value ConcurrentHashMap<Key, Value, Hash, Stats>::NO_MATCH_OLD = ((((size_t)1 << 62) - 4) << BITS_MARKED);
+
+template <typename Key, typename Value, class Hash, class Stats>
+Key ConcurrentHashMap<Key, Value, Hash, Stats>::KINITIAL = ((((size_t)1 << 62) - 1) << BITS_MARKED);
+template <typename Key, typename Value, class Hash, class Stats>
+Key ConcurrentHashMap<Key, Value, Hash, Stats>::KTOMBSTONE = ((((size_t)1 << 62) - 2) << BITS_MARKED);
 
 #endif
@@ -0,0 +1,181 @@
+// Runtime statistics for ConcurrentHashMap.
+// What is counted is chosen by a policy, passed as a template parameter of the map.
+// NoMapStats counts nothing and compiles away entirely. ThreadMapStats keeps per-thread counters, summed when asked for.
+// Building with -DMAP_STATS makes ThreadMapStats the default policy.
+
+#ifndef MAP_STATS_HPP
+#define MAP_STATS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "define.hpp"
+
+// Places where a failed CAS makes an operation retry or give way to another thread.
+enum class CasSite : size_t
+{
+    // Claiming an empty key slot, in the probe sequence or the stash.
+    KEY_CLAIM,
+    // Updating the value of a claimed slot.
+    VALUE_UPDATE,
+    // Marking a slot for migration, or retiring it once copied.
+    SLOT_MIGRATE,
+    // Placing a bulk migrated pair into the new table.
+    COPY_PAIR,
+    // Installing the next table of a resize.
+    NEW_TABLE,
+    // Promoting the next table once the old one is drained.
+    PROMOTE,
+    COUNT
+};
+
+// Event counters kept by a statistics policy.
+enum class MapCounter : size_t
+{
+    // Lookups that found their key, and the slots they probed.
+    LOOKUP_HITS,
+    LOOKUP_HIT_PROBES,
+    // Lookups that did not, and the slots they probed.
+    LOOKUP_MISSES,
+    LOOKUP_MISS_PROBES,
+    // Inserts, replaces and removes, and the slots they probed, not counting migration copies.
+    WRITES,
+    WRITE_PROBES,
+    // Resizes this map started and finished.
+    RESIZES_STARTED,
+    RESIZES_COMPLETED,
+    // Pairs copied into a newer table.
+    SLOTS_COPIED,
+    // Chunks of migration work finished by any thread.
+    CHUNKS_HELPED,
+    // Unpersisted words that lookups had to flush before returning them.
+    READER_FLUSHES,
+    // Failed CASes, one counter per CasSite.
+    CAS_FAILURES,
+    COUNT = CAS_FAILURES + (size_t)CasSite::COUNT
+};
+
+// A snapshot of a map's runtime statistics.
+struct MapStats
+{
+    // Whether the map was built with a policy that counts anything.
+    bool enabled = false;
+    size_t lookupHits = 0;
+    size_t lookupHitProbes = 0;
+    size_t lookupMisses = 0;
+    size_t lookupMissProbes = 0;
+    size_t writes = 0;
+    size_t writeProbes = 0;
+    size_t resizesStarted = 0;
+    size_t resizesCompleted = 0;
+    size_t slotsCopied = 0;
+    size_t chunksHelped = 0;
+    // Time foreground operations spent helping to migrate, summed over threads.
+    double helpSeconds = 0;
+    size_t readerFlushes = 0;
+    size_t casFailures[(size_t)CasSite::COUNT] = {};
+    // The number of tables reachable from the top table, itself included.
+    size_t chainDepth = 0;
+
+    void print(std::ostream &stream) const
+    {
+        static const char *const SITES[] = {"key claim", "value update", "slot migrate", "copy pair", "new table", "promote"};
+        stream << "lookup hits = " << lookupHits << " (" << (lookupHits > 0 ? (double)lookupHitProbes / lookupHits : 0) << " probes each)" << std::endl
+               << "lookup misses = " << lookupMisses << " (" << (lookupMisses > 0 ? (double)lookupMissProbes / lookupMisses : 0) << " probes each)" << std::endl
+               << "writes = " << writes << " (" << (writes > 0 ? (double)writeProbes / writes : 0) << " probes each)" << std::endl
+               << "resizes = " << resizesStarted << " started, " << resizesCompleted << " completed" << std::endl
+               << "slots copied = " << slotsCopied << ", chunks helped = " << chunksHelped << ", help time = " << helpSeconds << "s" << std::endl
+               << "reader flushes = " << readerFlushes << std::endl
+               << "CAS failures:";
+        for (size_t site = 0; site < (size_t)CasSite::COUNT; site++)
+        {
+            stream << (site > 0 ? "," : "") << " " << SITES[site] << " = " << casFailures[site];
+        }
+        stream << std::endl
+               << "table chain depth = " << chainDepth << std::endl;
+    }
+};
+
+// Counts nothing. Every call compiles to nothing.
+struct NoMapStats
+{
+    static constexpr bool ENABLED = false;
+
+    void add(MapCounter, size_t = 1)
+    {
+    }
+    void casFailed(CasSite)
+    {
+    }
+    void collect(MapStats &) const
+    {
+    }
+};
+
+// Counts into one cache line aligned set of counters per thread, indexed by localThreadNum.
+// Threads sharing an index, such as background threads, still count correctly, just with contention.
+struct ThreadMapStats
+{
+    static constexpr bool ENABLED = true;
+    // Threads beyond this share counters.
+    static const size_t MAX_THREADS = 256;
+
+    void add(MapCounter counter, size_t amount = 1)
+    {
+        local().counts[(size_t)counter].fetch_add(amount, std::memory_order_relaxed);
+    }
+    void casFailed(CasSite site)
+    {
+        add((MapCounter)((size_t)MapCounter::CAS_FAILURES + (size_t)site));
+    }
+    // Sum the counters of every thread into a snapshot.
+    void collect(MapStats &stats) const
+    {
+        size_t totals[(size_t)MapCounter::COUNT] = {};
+        for (size_t t = 0; t < MAX_THREADS; t++)
+        {
+            for (size_t c = 0; c < (size_t)MapCounter::COUNT; c++)
+            {
+                totals[c] += threads[t].counts[c].load(std::memory_order_relaxed);
+            }
+        }
+        stats.enabled = true;
+        stats.lookupHits = totals[(size_t)MapCounter::LOOKUP_HITS];
+        stats.lookupHitProbes = totals[(size_t)MapCounter::LOOKUP_HIT_PROBES];
+        stats.lookupMisses = totals[(size_t)MapCounter::LOOKUP_MISSES];
+        stats.lookupMissProbes = totals[(size_t)MapCounter::LOOKUP_MISS_PROBES];
+        stats.writes = totals[(size_t)MapCounter::WRITES];
+        stats.writeProbes = totals[(size_t)MapCounter::WRITE_PROBES];
+        stats.resizesStarted = totals[(size_t)MapCounter::RESIZES_STARTED];
+        stats.resizesCompleted = totals[(size_t)MapCounter::RESIZES_COMPLETED];
+        stats.slotsCopied = totals[(size_t)MapCounter::SLOTS_COPIED];
+        stats.chunksHelped = totals[(size_t)MapCounter::CHUNKS_HELPED];
+        stats.readerFlushes = totals[(size_t)MapCounter::READER_FLUSHES];
+        for (size_t site = 0; site < (size_t)CasSite::COUNT; site++)
+        {
+            stats.casFailures[site] = totals[(size_t)MapCounter::CAS_FAILURES + site];
+        }
+    }
+
+private:
+    struct alignas(CACHELINESZ) Counters
+    {
+        std::atomic<uint64_t> counts[(size_t)MapCounter::COUNT] = {};
+    };
+    Counters &local()
+    {
+        return threads[localThreadNum % MAX_THREADS];
+    }
+
+    Counters threads[MAX_THREADS];
+};
+
+#ifdef MAP_STATS
+using DefaultMapStats = ThreadMapStats;
+#else
+using DefaultMapStats = NoMapStats;
+#endif
+
+#endif
@@ -0,0 +1,456 @@
+// A single preallocated pool file (or device-DAX region) that backs every table of a map.
+// Without a pool, each resize creates, truncates, and maps a brand new file.
+// With a pool, resizing only carves an extent out of memory that is already mapped.
+
+// Layout: a header holding the extent records, followed by the extents themselves.
+// Each extent record is persisted before it is trusted, so the pool can be reopened after a crash.
+// Only extents marked USED hold tables. Everything else can be reused.
+
+#ifndef TABLE_POOL_HPP
+#define TABLE_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+// Persistence functions.
+#include "persistence.hpp"
+
+class TablePool
+{
+public:
+    // Every extent starts on a page boundary.
+    static const size_t EXTENT_ALIGN = 4096;
+    // The maximum number of extents the pool can track at once.
+    static const size_t MAX_EXTENTS = 1024;
+    // Identifies an initialized pool.
+    static const uint64_t POOL_MAGIC = 0x4c4f4f5050414d50;
+
+    // The persistent state of an extent record.
+    enum ExtentState : uint64_t
+    {
+        // The record is unused.
+        EMPTY = 0,
+        // The extent is available for reuse.
+        FREE = 1,
+        // The extent holds a table.
+        USED = 2
+    };
+
+    // A persistent extent record.
+    // The state is written last and persisted on its own, so a torn record is never trusted.
+    struct Extent
+    {
+        std::atomic<uint64_t> state;
+        uint64_t offset;
+        uint64_t length;
+        // The table ID of a USED extent. Orders tables during recovery.
+        uint64_t id;
+    };
+
+    // The persistent pool header.
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t length;
+        Extent extents[MAX_EXTENTS];
+    };
+
+    // A table found in the pool during recovery.
+    struct Allocation
+    {
+        size_t id;
+        void *address;
+        size_t length;
+    };
+
+    // Open an existing pool, or create one of the given size (in bytes).
+    // Device-DAX character devices are mapped in full and their size is ignored.
+    TablePool(const std::string &path, size_t size)
+    {
+        struct stat finfo;
+        bool exists = (stat(path.c_str(), &finfo) == 0);
+
+        fd = open(path.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            std::cerr << "Failed to create or open the pool. errno = "
+                      << errno << ", " << strerror(errno) << std::endl;
+            throw std::runtime_error("cannot create or open pool");
+        }
+
+        // Device-DAX exposes its size through sysfs rather than through stat().
+        if (exists && S_ISCHR(finfo.st_mode))
+        {
+            length = devDaxSize(finfo.st_rdev);
+        }
+        else
+        {
+            // Use an existing pool as-is.
+            length = exists ? (size_t)finfo.st_size : 0;
+            if (length == 0)
+            {
+                length = size;
+                // Reserve the blocks up front, so no allocation ever touches file system metadata again.
+                if (posix_fallocate(fd, 0, length) != 0)
+                {
+                    std::cerr << "Failed to allocate the pool." << std::endl;
+                    throw std::runtime_error("cannot allocate pool");
+                }
+            }
+        }
+        if (length <= headerLength())
+        {
+            throw std::runtime_error("pool is too small");
+        }
+
+        base = (char *)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED)
+        {
+            std::cerr << "Failed to mmap the pool. errno = "
+                      << errno << ", " << strerror(errno) << std::endl;
+            throw std::runtime_error("mmap pool failed");
+        }
+        header = (Header *)base;
+
+        // Format a new pool.
+        if (header->magic != POOL_MAGIC)
+        {
+            memset((void *)header->extents, 0, sizeof(header->extents));
+            header->length = length;
+            PERSIST(header, sizeof(Header));
+            // The magic number goes last, so a partially formatted pool is formatted again.
+            header->magic = POOL_MAGIC;
+            PERSIST(&header->magic, sizeof(header->magic));
+        }
+        normalize();
+        return;
+    }
+    ~TablePool()
+    {
+        munmap(base, length);
+        close(fd);
+        return;
+    }
+
+    // Reserve an extent of at least the given number of bytes.
+    // The extent does not survive a crash until it is committed.
+    // Returns NULL if the pool is exhausted.
+    void *allocate(size_t bytes)
+    {
+        bytes = alignUp(bytes);
+        std::lock_guard<std::mutex> guard(lock);
+
+        size_t idx = findFree(bytes);
+        if (idx == MAX_EXTENTS)
+        {
+            // Adjacent free extents may be able to satisfy the request together.
+            coalesce();
+            idx = findFree(bytes);
+        }
+        if (idx != MAX_EXTENTS)
+        {
+            Extent &e = header->extents[idx];
+            // Split off the unused tail as its own free extent.
+            if (e.length > bytes)
+            {
+                size_t rest = emptyRecord();
+                if (rest != MAX_EXTENTS)
+                {
+                    Extent &r = header->extents[rest];
+                    r.offset = e.offset + bytes;
+                    r.length = e.length - bytes;
+                    PERSIST(&r, sizeof(Extent));
+                    publish(r, FREE);
+                    // A crash before this point leaves the tail inside the original extent, which recovery discards.
+                    e.length = bytes;
+                    PERSIST(&e, sizeof(Extent));
+                }
+            }
+            reserved[idx] = true;
+            return base + e.offset;
+        }
+
+        // Nothing to recycle. Bump the end of the pool instead.
+        idx = emptyRecord();
+        if (idx == MAX_EXTENTS || bump + bytes > length)
+        {
+            return NULL;
+        }
+        Extent &e = header->extents[idx];
+        e.offset = bump;
+        e.length = bytes;
+        bump += bytes;
+        // The record stays EMPTY until committed, so a crash simply forgets it.
+        reserved[idx] = true;
+        return base + e.offset;
+    }
+
+    // Make a reserved extent durable as the table with the given ID.
+    // The table contents must already be persisted.
+    void commit(void *address, size_t id)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t idx = find(address);
+        assert(idx != MAX_EXTENTS && reserved[idx]);
+        Extent &e = header->extents[idx];
+        e.id = id;
+        PERSIST(&e, sizeof(Extent));
+        publish(e, USED);
+        reserved[idx] = false;
+        return;
+    }
+
+    // Return an extent to the pool, whether it was committed or only reserved.
+    void release(void *address)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t idx = find(address);
+        assert(idx != MAX_EXTENTS);
+        reserved[idx] = false;
+        // An uncommitted bump allocation was never written to its record.
+        if (header->extents[idx].state.load() == EMPTY)
+        {
+            // Give the space back if nothing was allocated after it.
+            if (header->extents[idx].offset + header->extents[idx].length == bump)
+            {
+                bump = header->extents[idx].offset;
+            }
+            header->extents[idx].length = 0;
+            return;
+        }
+        publish(header->extents[idx], FREE);
+        return;
+    }
+
+    // Free a committed extent for good, while keeping it from being handed out again as long as the pool is open.
+    // For tables other threads may still be reading. The next open of the pool reuses the extent.
+    void retire(void *address)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        size_t idx = find(address);
+        assert(idx != MAX_EXTENTS && header->extents[idx].state.load() == USED);
+        reserved[idx] = true;
+        publish(header->extents[idx], FREE);
+        return;
+    }
+
+    // All committed tables, ordered by ID.
+    std::vector<Allocation> tables()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        std::vector<Allocation> ret;
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            Extent &e = header->extents[i];
+            if (e.state.load() == USED)
+            {
+                ret.push_back(Allocation{e.id, base + e.offset, e.length});
+            }
+        }
+        std::sort(ret.begin(), ret.end(),
+                  [](const Allocation &a, const Allocation &b)
+                  {
+                      return a.id < b.id;
+                  });
+        return ret;
+    }
+
+    // The file descriptor of the pool, for operations on the underlying blocks.
+    int descriptor()
+    {
+        return fd;
+    }
+
+    // The offset of an address within the pool.
+    size_t offsetOf(const void *address)
+    {
+        return (const char *)address - base;
+    }
+
+    // Read the size of a device-DAX region from sysfs.
+    static size_t devDaxSize(dev_t dev)
+    {
+        std::string sysPath = "/sys/dev/char/" + std::to_string(major(dev)) + ":" + std::to_string(minor(dev)) + "/size";
+        std::ifstream sizeFile(sysPath);
+        size_t size = 0;
+        if (!(sizeFile >> size))
+        {
+            throw std::runtime_error("cannot read device-DAX size");
+        }
+        return size;
+    }
+
+private:
+    // The mapped pool.
+    char *base;
+    Header *header;
+    size_t length;
+    int fd;
+
+    // Volatile allocator state, rebuilt on open.
+    // Extents handed out but not yet committed.
+    bool reserved[MAX_EXTENTS] = {};
+    // The end of the last extent in use.
+    size_t bump;
+    // Allocation only happens on resize, so a lock is cheap here.
+    std::mutex lock;
+
+    static size_t alignUp(size_t bytes)
+    {
+        return (bytes + EXTENT_ALIGN - 1) & ~(EXTENT_ALIGN - 1);
+    }
+    static size_t headerLength()
+    {
+        return alignUp(sizeof(Header));
+    }
+
+    // Persist a new state for a record.
+    static void publish(Extent &e, ExtentState state)
+    {
+        e.state.store(state);
+        PERSIST(&e.state, sizeof(e.state));
+    }
+
+    // Find the smallest free extent that fits.
+    size_t findFree(size_t bytes)
+    {
+        size_t best = MAX_EXTENTS;
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            Extent &e = header->extents[i];
+            if (e.state.load() == FREE && !reserved[i] && e.length >= bytes &&
+                (best == MAX_EXTENTS || e.length < header->extents[best].length))
+            {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // Find an unused record.
+    size_t emptyRecord()
+    {
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            if (header->extents[i].state.load() == EMPTY && !reserved[i])
+            {
+                return i;
+            }
+        }
+        return MAX_EXTENTS;
+    }
+
+    // Find the record of an extent by its address.
+    size_t find(void *address)
+    {
+        size_t offset = offsetOf(address);
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            Extent &e = header->extents[i];
+            if (e.offset == offset && (e.state.load() != EMPTY || reserved[i]))
+            {
+                return i;
+            }
+        }
+        return MAX_EXTENTS;
+    }
+
+    // Merge adjacent free extents, and give free space at the end back to the bump allocator.
+    void coalesce()
+    {
+        std::vector<size_t> free;
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            if (header->extents[i].state.load() == FREE && !reserved[i])
+            {
+                free.push_back(i);
+            }
+        }
+        std::sort(free.begin(), free.end(),
+                  [this](size_t a, size_t b)
+                  {
+                      return header->extents[a].offset < header->extents[b].offset;
+                  });
+        for (size_t i = 0; i + 1 < free.size(); i++)
+        {
+            Extent &a = header->extents[free[i]];
+            Extent &b = header->extents[free[i + 1]];
+            if (a.offset + a.length == b.offset)
+            {
+                // Grow the lower extent first. A crash in between leaves b inside a, which recovery discards.
+                a.length += b.length;
+                PERSIST(&a, sizeof(Extent));
+                publish(b, EMPTY);
+                // Keep merging into the lower extent.
+                free[i + 1] = free[i];
+            }
+        }
+        // Trailing free space is cheaper to hand out through the bump pointer.
+        if (!free.empty())
+        {
+            Extent &last = header->extents[free.back()];
+            if (last.offset + last.length == bump)
+            {
+                bump = last.offset;
+                publish(last, EMPTY);
+            }
+        }
+        return;
+    }
+
+    // Clean up after a crash and rebuild the volatile state.
+    void normalize()
+    {
+        // Drop free extents left inside other free extents by an interrupted split or merge.
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            Extent &inner = header->extents[i];
+            if (inner.state.load() != FREE)
+            {
+                continue;
+            }
+            for (size_t j = 0; j < MAX_EXTENTS; j++)
+            {
+                Extent &outer = header->extents[j];
+                if (i != j && outer.state.load() == FREE &&
+                    outer.offset <= inner.offset &&
+                    inner.offset + inner.length <= outer.offset + outer.length &&
+                    // Keep one of two identical extents.
+                    (outer.length != inner.length || j < i))
+                {
+                    publish(inner, EMPTY);
+                    break;
+                }
+            }
+        }
+        // Everything past the last live extent is unallocated.
+        bump = headerLength();
+        for (size_t i = 0; i < MAX_EXTENTS; i++)
+        {
+            Extent &e = header->extents[i];
+            if (e.state.load() != EMPTY)
+            {
+                bump = std::max(bump, (size_t)(e.offset + e.length));
+            }
+        }
+        return;
+    }
+};
+
+#endif
@@ -2,26 +2,48 @@
 #ifndef CONTAINER_HPP
 #define CONTAINER_HPP
 
+#include <concepts>
+#include <iostream>
+
 #include "define.hpp"
 
-class Container
+// A container the harness can test.
+// Tests are templates over their container, so every operation binds statically and can inline into the benchmark loop.
+template <class C>
+concept Container = std::constructible_from<C, const TestOptions &, bool> &&
+                    requires(C &c, KeyT key, ValT val) {
+                        // Insert a value.
+                        { c.insert(val) } -> std::convertible_to<bool>;
+                        // Remove a value.
+                        { c.erase(key) } -> std::convertible_to<bool>;
+                        // Check for the existance of a value associated with a key.
+                        { c.contains(key) } -> std::convertible_to<bool>;
+                        // Retrieve the value associated with a key.
+                        { c.get(key) } -> std::convertible_to<ValT>;
+                        // Retrieve the number of elements logically in the data structure.
+                        { c.count() } -> std::convertible_to<size_t>;
+                        // Increment the value associated with the key by one.
+                        { c.increment(key) } -> std::convertible_to<ValT>;
+                        // Replace the value associated with a key, only if the key is present.
+                        // Returns whether it was, so an update never turns into an insert.
+                        { c.update(key, val) } -> std::convertible_to<bool>;
+                        // Read the value associated with a present key and replace it, as one operation if the container can.
+                        // Returns the value read, or 0 if the key is absent, which leaves it absent.
+                        { c.readModifyWrite(key, val) } -> std::convertible_to<ValT>;
+                        // Internal data structure validation.
+                        // This is highly unique to each data structure.
+                        { c.isConsistent() } -> std::convertible_to<bool>;
+                    };
+
+// Report container-specific statistics after a test.
+// Most containers have none, and need not define printStats.
+template <Container C>
+void printContainerStats(C &c, std::ostream &stream)
 {
-public:
-    // Insert a value.
-    virtual bool insert(ValT el) = 0;
-    // Remove a value.
-    virtual bool erase(ValT el) = 0;
-    // Check for the existance of a value associated with a key.
-    virtual bool contains(KeyT el) = 0;
-    // Retrieve the value associated with a key.
-    virtual ValT get(KeyT el) = 0;
-    // Retrieve the number of elements logically in the data structure.
-    virtual size_t count() = 0;
-    // Increment the value associated with the key by one.
-    virtual ValT increment(KeyT el) = 0;
-    // Internal data structure validation.
-    // This is highly unique to each data structure.
-    virtual bool isConsistent() = 0;
-};
+    if constexpr (requires { c.printStats(stream); })
+    {
+        c.printStats(stream);
+    }
+}
 
-#endif
\ No newline at end of file
+#endif
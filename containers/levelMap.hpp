@@ -31,7 +31,7 @@ namespace clevel
         pmem::obj::persistent_ptr<map_type> cons;
     };
 
-    struct container_type : Container
+    struct container_type final
     {
         using pool = pmem::obj::pool<root>;
         using value_type = root::map_type::value_type;
@@ -95,6 +95,22 @@ namespace clevel
             return insert((ValT)el);
         }
 
+        // clevel_hash replaces the whole pair out of place, and only if the key is present.
+        bool update(KeyT key, ValT val)
+        {
+            auto map = pop.root()->cons;
+            assert(map != nullptr);
+
+            auto r = map->update(value_type(key, val), localThreadNum);
+            return r.found;
+        }
+
+        // There is no way to read a value, so the value read is reported as get() does.
+        ValT readModifyWrite(KeyT key, ValT val)
+        {
+            return update(key, val) ? key : 0;
+        }
+
         container_type(const TestOptions &opt, bool reconstruct = false)
         {
             const size_t realcapacity = 1 << opt.capacity;
@@ -13,7 +13,7 @@
 
 namespace onefile
 {
-    struct container_type : Container
+    struct container_type final
     {
         // using PTM    = poflf::OneFileLF;
         // using TMTYPE = poflf::tmtype;
@@ -72,6 +72,34 @@ namespace onefile
             return v;
         }
 
+        // Both run in one transaction, so a key found present is still present when it is written.
+        bool update(KeyT el, ValT val)
+        {
+            return PTM::template updateTx<bool>([&]() {
+                ValT old;
+                if (!c->innerGet(el, old, true))
+                {
+                    return false;
+                }
+                c->innerPut(el, val, old, false);
+                return true;
+            });
+        }
+
+        ValT readModifyWrite(KeyT el, ValT val)
+        {
+            return PTM::template updateTx<ValT>([&]() {
+                ValT old;
+                if (!c->innerGet(el, old, true))
+                {
+                    return (ValT)0;
+                }
+                ValT replaced;
+                c->innerPut(el, val, replaced, false);
+                return old;
+            });
+        }
+
         // TODO: Implement explicit recovery?
         container_type(const TestOptions &opt, bool reconstruct = false)
         {
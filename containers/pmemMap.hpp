@@ -24,7 +24,7 @@ namespace pm
         pmem::obj::persistent_ptr<map_type> pptr;
     };
 
-    struct container_type : Container
+    struct container_type final
     {
         using pool = pmem::obj::pool<root>;
         using value_type = root::map_type::value_type;
@@ -85,6 +85,33 @@ namespace pm
             return (ValT)el;
         }
 
+        // The accessor holds the element's write lock while the value is written and persisted.
+        bool update(KeyT el, ValT val)
+        {
+            pm::root::map_type::accessor result;
+            if (!pop.root()->pptr->find(result, el))
+            {
+                return false;
+            }
+            result->second = val;
+            pop.persist(result->second);
+            return true;
+        }
+
+        // The read and the write happen under the same lock, so this is atomic.
+        ValT readModifyWrite(KeyT el, ValT val)
+        {
+            pm::root::map_type::accessor result;
+            if (!pop.root()->pptr->find(result, el))
+            {
+                return ValT(0);
+            }
+            ValT old = result->second;
+            result->second = val;
+            pop.persist(result->second);
+            return old;
+        }
+
         // TODO: Make reconstruction optional.
         container_type(const TestOptions &opt, bool reconstruct = false)
         {
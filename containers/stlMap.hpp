@@ -9,7 +9,7 @@
 namespace stl
 {
 
-    struct container_type : Container
+    struct container_type final
     {
         using mutex_type = std::mutex;
         using guard_type = std::lock_guard<mutex_type>;
@@ -65,6 +65,31 @@ namespace stl
             return t;
         }
 
+        bool update(KeyT el, ValT val)
+        {
+            guard_type g(global_lock);
+            auto it = c->find(el);
+            if (it == c->end())
+            {
+                return false;
+            }
+            it->second = val;
+            return true;
+        }
+
+        ValT readModifyWrite(KeyT el, ValT val)
+        {
+            guard_type g(global_lock);
+            auto it = c->find(el);
+            if (it == c->end())
+            {
+                return 0;
+            }
+            ValT old = it->second;
+            it->second = val;
+            return old;
+        }
+
         // This constructor offers no persistence.
         // Reconstruct is unused.
         container_type(const TestOptions &, __attribute__((unused)) bool reconstruct = false)
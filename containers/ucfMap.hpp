@@ -6,7 +6,7 @@
 
 namespace ucf
 {
-    struct container_type : Container
+    struct container_type final
     {
         ConcurrentHashMap<KeyT, ValT> *c;
 
@@ -45,22 +45,70 @@ namespace ucf
             return c->update(el << ConcurrentHashMap<KeyT, ValT>::BITS_MARKED, ((((size_t)1 << 61) - 3) << ConcurrentHashMap<KeyT, ValT>::BITS_MARKED), ConcurrentHashMap<KeyT, ValT>::Table::increment);
         }
 
+        bool update(KeyT el, ValT val)
+        {
+            ValT old = c->replace(el << ConcurrentHashMap<KeyT, ValT>::BITS_MARKED, val << ConcurrentHashMap<KeyT, ValT>::BITS_MARKED);
+            return !ConcurrentHashMap<KeyT, ValT>::isValueReserved(old);
+        }
+
+        // A single CAS replaces the value it read, so this is atomic.
+        ValT readModifyWrite(KeyT el, ValT val)
+        {
+            ValT old = c->replace(el << ConcurrentHashMap<KeyT, ValT>::BITS_MARKED, val << ConcurrentHashMap<KeyT, ValT>::BITS_MARKED);
+            return ConcurrentHashMap<KeyT, ValT>::isValueReserved(old) ? 0 : old >> ConcurrentHashMap<KeyT, ValT>::BITS_MARKED;
+        }
+
         container_type(const TestOptions &opt, bool reconstruct = false)
         {
             const size_t realcapacity = 1 << opt.capacity;
             const char *path = opt.filename.c_str();
-            c = new ConcurrentHashMap<KeyT, ValT>(path, realcapacity, reconstruct);
+            MapOptions options;
+            options.poolPath = opt.poolFile;
+            options.poolSize = opt.poolSize << 20;
+            options.preallocThreshold = opt.preallocThreshold;
+            options.migrators = opt.migrators;
+            options.copyBudget = parseCopyBudget(opt.copyBudget);
+            options.loadFactor = opt.loadFactor;
+            options.probeLimit = opt.probeLimit;
+            options.growthFactor = opt.growthFactor;
+            options.releaseChunks = opt.releaseChunks;
+            options.recoveryMigrators = opt.recoveryMigrators;
+            options.placement = parsePagePlacement(opt.tablePlacement);
+            c = new ConcurrentHashMap<KeyT, ValT>(path, realcapacity, reconstruct, options);
             if (c == nullptr)
                 throw std::runtime_error("could not allocate");
             return;
         }
 
+        ~container_type()
+        {
+            // Stops background threads and unmaps the tables. The data stays persistent.
+            delete c;
+        }
+
         bool isConsistent()
         {
             // Consistency is already checked during recovery.
             // Thus, we leave this empty for now.
             return true;
         }
+
+        void printStats(std::ostream &stream)
+        {
+            MigrationMetrics metrics = c->migrationMetrics();
+            stream << "migrations = " << metrics.migrations << std::endl
+                   << "migrated = " << metrics.bytes / (1 << 20) << "MiB in " << metrics.migrationSeconds << "s ("
+                   << metrics.gigabytesPerSecond() << "GB/s)" << std::endl
+                   << "helper time = " << metrics.helperSeconds << "s" << std::endl
+                   << "migrator time = " << metrics.migratorSeconds << "s" << std::endl
+                   << "released early = " << metrics.releasedBytes / (1 << 20) << "MiB" << std::endl;
+            // Only maps built with -DMAP_STATS count anything more.
+            MapStats stats = c->stats();
+            if (stats.enabled)
+            {
+                stats.print(stream);
+            }
+        }
     };
 
 } // namespace ucf
@@ -21,4 +21,7 @@ do
     sed -i '/usertable/!d' $PMAPDATA/YCSB/outputRun$alpha.txt
     # Filter operation lines to just the operation and key.
     sed -r -i 's/(READ|INSERT|UPDATE|DELETE) usertable user([0-9]{1,20}).*$/\1 \2/gm' $PMAPDATA/YCSB/outputRun$alpha.txt
+
+    # Convert both phases into the binary trace the test maps (make ycsb-convert).
+    $PMAPDATA/../bin/ycsb-convert --load $PMAPDATA/YCSB/outputLoad$alpha.txt --run $PMAPDATA/YCSB/outputRun$alpha.txt -o $PMAPDATA/YCSB/workload$alpha.trace
 done
\ No newline at end of file
@@ -7,9 +7,12 @@
 #include <typeinfo>
 #include <atomic>
 
+#include "latency.hpp"
+#include "perfCounters.hpp"
+
 // Globally defined constants, functions, etc.
 
-using time_point = std::chrono::time_point<std::chrono::system_clock>;
+using time_point = std::chrono::time_point<std::chrono::steady_clock>;
 using duration_unit = std::chrono::milliseconds;
 
 // The key and value datatypes.
@@ -39,6 +42,10 @@ std::atomic<size_t> fileNameCounter{0};
 // The test itself has final say in which parameters are used.
 struct TestOptions
 {
+    // The container to test, by registered name.
+    std::string container;
+    // The workload to run on it, by registered name.
+    std::string workload;
     // Number of threads to spawn and use.
     size_t numthreads;
     // Number of operations to run, shared accross all threads.
@@ -53,6 +60,60 @@ struct TestOptions
     bool recover;
     // Whether to wipe or recover the file.
     bool wipeFile;
+    // Pool file or device-DAX region backing all tables. Empty uses one file per table.
+    std::string poolFile;
+    // Size of a newly created pool, in MiB.
+    size_t poolSize;
+    // Load of the top table at which the next table is prepared in the background. Zero disables it.
+    double preallocThreshold;
+    // Number of dedicated table migration threads.
+    size_t migrators;
+    // Migration work a single operation may help with: "unlimited", "none", or a number of chunks.
+    std::string copyBudget;
+    // Fraction of a table's slots holding keys at which the table is resized.
+    double loadFactor;
+    // The most slots a probe sequence may cover before a key goes to the overflow stash.
+    size_t probeLimit;
+    // Factor by which each new table is larger than the one it replaces.
+    double growthFactor;
+    // Whether to release the memory of migrated chunks during a migration.
+    bool releaseChunks;
+    // Threads that finish interrupted migrations in the background after recovery.
+    size_t recoveryMigrators;
+    // Where the pages of new tables go among the NUMA nodes: "first-touch", "interleave", or "bind:N".
+    std::string tablePlacement;
+    // Whether to record the latency of every operation.
+    bool latency;
+    // Whether to count cycles, instructions, cache and TLB misses with hardware counters.
+    bool perf;
+    // Seconds to measure for, after the warmup. Zero runs a fixed number of operations instead.
+    double duration;
+    // Seconds to run before measuring, in duration mode.
+    double warmup;
+    // The YCSB workload to run, a to f, and the directory holding its converted trace.
+    std::string ycsbWorkload;
+    std::string ycsbDir;
+    // A YCSB trace to run instead of the workload's trace in ycsbDir.
+    std::string ycsbTrace;
+    // Whether to generate the YCSB workload in process, rather than read a trace.
+    bool ycsbGenerate;
+    // For generated workloads: records loaded, the "read,update,insert,rmw" mix and the request distribution,
+    // both empty for the workload's own, the zipfian skew and the seed.
+    size_t ycsbRecords;
+    std::string ycsbMix;
+    std::string ycsbDistribution;
+    double ycsbTheta;
+    size_t ycsbSeed;
+    // For the random workload: "insert,erase,contains,get,count,increment" weights, keys drawn from [1, keyRange],
+    // the seed, and whether to draw every thread's operations before the test starts.
+    std::string randomMix;
+    size_t keyRange;
+    size_t randomSeed;
+    bool randomPregenerate;
+    // Where test threads run: "none", "compact", "scatter", or a CPU list such as "0-3,8".
+    std::string pinning;
+    // Where anonymous memory is allocated: "default", "local", "interleave", "bind:N", or "bind:pmem" for the node of the PMEM device.
+    std::string memoryPolicy;
 
     TestOptions();
 
@@ -60,6 +121,8 @@ struct TestOptions
     void print()
     {
         std::cout << "*** concurrent container test "
+                  << "\n***                  container: " << container
+                  << "\n***                   workload: " << workload
                   << "\n***          number of threads: " << numthreads
                   << "\n*** total number of operations: " << numops
                   << "\n***       total number of runs: " << numruns
@@ -68,13 +131,40 @@ struct TestOptions
                   << "\n***                mapped file: " << filename
                   << "\n***                    recover: " << recover
                   << "\n***                  wipe file: " << wipeFile
-                  //<< "\n***                  test type: " << typeid(test_type).name()
-                  //<< "\n***             container type: " << typeid(container_type).name()
+                  << "\n***                  pool file: " << (poolFile.empty() ? "none" : poolFile)
+                  << "\n***            pool size (MiB): " << poolSize
+                  << "\n***    preallocation threshold: " << preallocThreshold
+                  << "\n***                  migrators: " << migrators
+                  << "\n***                copy budget: " << copyBudget
+                  << "\n***                load factor: " << loadFactor
+                  << "\n***                probe limit: " << probeLimit
+                  << "\n***              growth factor: " << growthFactor
+                  << "\n***             release chunks: " << releaseChunks
+                  << "\n***         recovery migrators: " << recoveryMigrators
+                  << "\n***            table placement: " << tablePlacement
+                  << "\n***                    latency: " << latency
+                  << "\n***          hardware counters: " << perf
+                  << "\n***             duration (sec): " << duration
+                  << "\n***               warmup (sec): " << warmup
+                  << "\n***              YCSB workload: " << ycsbWorkload
+                  << "\n***                 YCSB trace: " << (ycsbGenerate ? "generated" : ycsbTrace.empty() ? ycsbDir : ycsbTrace)
+                  << "\n***                 random mix: " << randomMix
+                  << "\n***                  key range: " << keyRange
+                  << "\n***             thread pinning: " << pinning
+                  << "\n***              memory policy: " << memoryPolicy
                   << std::endl;
         return;
     }
 };
 
+// Operations completed by one thread, read by the main thread while the test runs.
+struct alignas(CACHELINESZ) ThreadProgress
+{
+    std::atomic<size_t> ops{0};
+    // When the thread finished its test, in steady clock nanoseconds.
+    std::atomic<int64_t> finished{0};
+};
+
 struct alignas(CACHELINESZ) ThreadInfo
 {
     // container_type*
@@ -86,10 +176,20 @@ struct alignas(CACHELINESZ) ThreadInfo
     size_t pnoiter;
     size_t num_threads;
     size_t num_held_back;
-
-    ThreadInfo(void *r, size_t n, size_t cntiter, size_t cntthreads)
+    // Where to record operation latencies, by operation type, or nullptr to skip timing.
+    OpLatencies *latency;
+    // Hardware counters for the thread's test, or nullptr to skip counting.
+    PerfCounters *perf;
+    // Where to count completed operations, or nullptr to skip counting.
+    ThreadProgress *progress;
+    // Set when a test running for a duration must stop. nullptr when running a fixed number of operations.
+    const std::atomic<bool> *stop;
+    // The CPU to pin the thread to, or -1 to leave it unpinned.
+    int cpu;
+
+    ThreadInfo(void *r, size_t n, size_t cntiter, size_t cntthreads, OpLatencies *lat = nullptr, PerfCounters *pc = nullptr)
         : container(r), num(n), fail(0), succ(0), pnoiter(cntiter), num_threads(cntthreads),
-          num_held_back(0)
+          num_held_back(0), latency(lat), perf(pc), progress(nullptr), stop(nullptr), cpu(-1)
     {
         assert(num < num_threads);
     }
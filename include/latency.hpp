@@ -0,0 +1,219 @@
+// Operation latency tracking for the test harness.
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <x86intrin.h>
+
+// Nanoseconds per time stamp counter tick.
+// Measured against the steady clock the first time it is needed, which takes a few milliseconds.
+inline double tscNanosPerTick()
+{
+    static const double ratio = []()
+    {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t startTicks = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t ticks = __rdtsc() - startTicks;
+        double nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        return ticks > 0 ? nanos / ticks : 1.0;
+    }();
+    return ratio;
+}
+
+// A log-linear histogram of latencies in time stamp counter ticks.
+// Latencies below 2^SUB_BITS are exact. Larger ones fall into 2^SUB_BITS buckets per power of two, within about 3% of the true value.
+// Each thread records into its own histogram, and the histograms are merged afterwards.
+class LatencyHistogram
+{
+public:
+    static const size_t SUB_BITS = 5;
+    static const size_t SUB_COUNT = (size_t)1 << SUB_BITS;
+    static const size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    LatencyHistogram()
+    {
+        clear();
+    }
+    void clear()
+    {
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            counts[i] = 0;
+        }
+        total = 0;
+        maximum = 0;
+    }
+    void record(uint64_t ticks)
+    {
+        counts[bucket(ticks)]++;
+        total++;
+        if (ticks > maximum)
+        {
+            maximum = ticks;
+        }
+    }
+    void merge(const LatencyHistogram &other)
+    {
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        if (other.maximum > maximum)
+        {
+            maximum = other.maximum;
+        }
+    }
+    // The latency below which the given fraction of recorded latencies fall.
+    // Reported as the top of its bucket, so it never understates.
+    uint64_t percentile(double fraction) const
+    {
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(fraction * total);
+        if (rank >= total)
+        {
+            return maximum;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i];
+            if (seen > rank)
+            {
+                uint64_t top = highest(i);
+                return top < maximum ? top : maximum;
+            }
+        }
+        return maximum;
+    }
+    size_t count() const
+    {
+        return total;
+    }
+    // Print the usual percentiles, in microseconds.
+    void print(std::ostream &stream, const std::string &label) const
+    {
+        double micros = tscNanosPerTick() / 1e3;
+        stream << label << " latency (us): ops = " << total
+               << ", p50 = " << percentile(0.5) * micros
+               << ", p99 = " << percentile(0.99) * micros
+               << ", p99.9 = " << percentile(0.999) * micros
+               << ", max = " << maximum * micros << std::endl;
+    }
+
+private:
+    static size_t bucket(uint64_t ticks)
+    {
+        if (ticks < SUB_COUNT)
+        {
+            return ticks;
+        }
+        size_t shift = (63 - __builtin_clzll(ticks)) - SUB_BITS;
+        return ((shift + 1) << SUB_BITS) + ((ticks >> shift) - SUB_COUNT);
+    }
+    // The largest latency that falls into a bucket.
+    static uint64_t highest(size_t bucket)
+    {
+        if (bucket < SUB_COUNT)
+        {
+            return bucket;
+        }
+        size_t shift = (bucket >> SUB_BITS) - 1;
+        return (((bucket & (SUB_COUNT - 1)) + SUB_COUNT + 1) << shift) - 1;
+    }
+
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t maximum;
+};
+
+// The kinds of container operations tests time separately.
+enum class OpType : size_t
+{
+    INSERT,
+    ERASE,
+    CONTAINS,
+    GET,
+    COUNT,
+    INCREMENT,
+    UPDATE,
+    READ_MODIFY_WRITE,
+    TYPES
+};
+
+// One histogram per operation type.
+struct OpLatencies
+{
+    LatencyHistogram histograms[(size_t)OpType::TYPES];
+
+    LatencyHistogram &operator[](OpType type)
+    {
+        return histograms[(size_t)type];
+    }
+    void merge(const OpLatencies &other)
+    {
+        for (size_t type = 0; type < (size_t)OpType::TYPES; type++)
+        {
+            histograms[type].merge(other.histograms[type]);
+        }
+    }
+    // Print the percentiles of every operation type that was recorded, then of all of them together.
+    void print(std::ostream &stream) const
+    {
+        static const char *const NAMES[] = {"insert", "erase", "contains", "get", "count", "increment", "update", "read-modify-write"};
+        LatencyHistogram all;
+        for (size_t type = 0; type < (size_t)OpType::TYPES; type++)
+        {
+            if (histograms[type].count() > 0)
+            {
+                histograms[type].print(stream, NAMES[type]);
+                all.merge(histograms[type]);
+            }
+        }
+        all.print(stream, "operation");
+    }
+};
+
+// Times a scope into the histogram of an operation type, using the time stamp counter.
+// Does nothing without histograms, so tests can always use it.
+class LatencyTimer
+{
+public:
+    LatencyTimer(OpLatencies *latencies, OpType type)
+        : histogram(latencies != nullptr ? &(*latencies)[type] : nullptr)
+    {
+        if (histogram != nullptr)
+        {
+            // Keep the operation from starting before the counter is read.
+            _mm_lfence();
+            start = __rdtsc();
+            _mm_lfence();
+        }
+    }
+    ~LatencyTimer()
+    {
+        if (histogram != nullptr)
+        {
+            // rdtscp waits for the operation to finish.
+            unsigned int aux;
+            uint64_t end = __rdtscp(&aux);
+            histogram->record(end - start);
+        }
+    }
+
+private:
+    LatencyHistogram *histogram;
+    uint64_t start;
+};
+
+#endif
@@ -0,0 +1,415 @@
+// NUMA topology helpers, and the thread pinning and memory policies of the test harness.
+// These read sysfs and use getcpu() and set_mempolicy() directly, so libnuma is not required.
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+// The number of NUMA nodes in the system. Always at least one.
+inline size_t numaNodeCount()
+{
+    static const size_t count = []()
+    {
+        size_t nodes = 0;
+        std::error_code ec;
+        for (auto &p : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+        {
+            const std::string name = p.path().filename().string();
+            if (name.rfind("node", 0) == 0 && name.size() > 4 && isdigit(name[4]))
+            {
+                nodes++;
+            }
+        }
+        return nodes > 0 ? nodes : (size_t)1;
+    }();
+    return count;
+}
+
+// The NUMA node of the CPU the calling thread is currently running on.
+inline size_t currentNumaNode()
+{
+    unsigned int cpu;
+    unsigned int node;
+    if (getcpu(&cpu, &node) != 0)
+    {
+        return 0;
+    }
+    return node % numaNodeCount();
+}
+
+// The CPUs or nodes in a sysfs style list, such as "0-3,8,10-11".
+inline std::vector<size_t> parseCpuList(const std::string &list)
+{
+    std::vector<size_t> ids;
+    std::stringstream stream(list);
+    std::string range;
+    while (std::getline(stream, range, ','))
+    {
+        range.erase(std::remove_if(range.begin(), range.end(), [](char c) { return isspace(c); }), range.end());
+        if (range.empty())
+        {
+            continue;
+        }
+        size_t dash = range.find('-');
+        try
+        {
+            size_t first = std::stoul(range.substr(0, dash));
+            size_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (size_t id = first; id <= last; id++)
+            {
+                ids.push_back(id);
+            }
+        }
+        catch (const std::logic_error &)
+        {
+            throw std::runtime_error("bad CPU list: " + list);
+        }
+    }
+    return ids;
+}
+
+// The NUMA nodes of the system, in order. Node 0 alone if sysfs does not say.
+inline const std::vector<size_t> &numaNodes()
+{
+    static const std::vector<size_t> nodes = []()
+    {
+        std::ifstream file("/sys/devices/system/node/online");
+        std::string list;
+        std::vector<size_t> online;
+        if (std::getline(file, list))
+        {
+            online = parseCpuList(list);
+        }
+        return online.empty() ? std::vector<size_t>{0} : online;
+    }();
+    return nodes;
+}
+
+// The NUMA nodes that have memory, in order. Every node if sysfs does not say.
+inline const std::vector<size_t> &numaMemoryNodes()
+{
+    static const std::vector<size_t> nodes = []()
+    {
+        std::ifstream file("/sys/devices/system/node/has_memory");
+        std::string list;
+        std::vector<size_t> withMemory;
+        if (std::getline(file, list))
+        {
+            withMemory = parseCpuList(list);
+        }
+        return withMemory.empty() ? numaNodes() : withMemory;
+    }();
+    return nodes;
+}
+
+// The CPUs of a node this process may run on, in order.
+// Without sysfs, every allowed CPU is placed on node 0.
+inline std::vector<size_t> numaNodeCpus(size_t node)
+{
+    static cpu_set_t allowed = []()
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        sched_getaffinity(0, sizeof(set), &set);
+        return set;
+    }();
+    std::vector<size_t> listed;
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string list;
+    if (std::getline(file, list))
+    {
+        listed = parseCpuList(list);
+    }
+    else if (node == 0)
+    {
+        for (size_t cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            listed.push_back(cpu);
+        }
+    }
+    std::vector<size_t> cpus;
+    for (size_t cpu : listed)
+    {
+        if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+        {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// The node a CPU belongs to, or 0 if it is not listed on any.
+inline size_t cpuNumaNode(size_t cpu)
+{
+    for (size_t node : numaNodes())
+    {
+        std::vector<size_t> cpus = numaNodeCpus(node);
+        if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+        {
+            return node;
+        }
+    }
+    return 0;
+}
+
+// The CPU each test thread is pinned to, or an empty plan to leave threads unpinned.
+// Policies are "none", "compact", which fills one node before the next, "scatter", which deals threads
+// round robin across nodes, or an explicit CPU list such as "0-3,8".
+// Threads beyond the CPUs available wrap around and share them.
+inline std::vector<size_t> pinningPlan(const std::string &policy, size_t threads)
+{
+    std::vector<size_t> order;
+    if (policy == "none")
+    {
+        return order;
+    }
+    else if (policy == "compact")
+    {
+        for (size_t node : numaNodes())
+        {
+            std::vector<size_t> cpus = numaNodeCpus(node);
+            order.insert(order.end(), cpus.begin(), cpus.end());
+        }
+    }
+    else if (policy == "scatter")
+    {
+        std::vector<std::vector<size_t>> perNode;
+        for (size_t node : numaNodes())
+        {
+            perNode.push_back(numaNodeCpus(node));
+        }
+        for (size_t i = 0, added = 1; added > 0; i++)
+        {
+            added = 0;
+            for (const std::vector<size_t> &cpus : perNode)
+            {
+                if (i < cpus.size())
+                {
+                    order.push_back(cpus[i]);
+                    added++;
+                }
+            }
+        }
+    }
+    else
+    {
+        order = parseCpuList(policy);
+    }
+    if (order.empty())
+    {
+        throw std::runtime_error("no CPUs to pin to with policy " + policy);
+    }
+    std::vector<size_t> plan(threads);
+    for (size_t t = 0; t < threads; t++)
+    {
+        plan[t] = order[t % order.size()];
+    }
+    return plan;
+}
+
+// Pin the calling thread to one CPU. Returns the error number, or 0.
+inline int pinThread(size_t cpu)
+{
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+}
+
+// The NUMA node owning the persistent memory device that holds a path, found through sysfs.
+// The path may not exist yet, in which case its closest existing parent is used.
+inline size_t pmemNumaNode(const std::string &path)
+{
+    std::filesystem::path existing(path);
+    struct stat info;
+    while (stat(existing.c_str(), &info) != 0 && existing.has_parent_path() && existing != existing.parent_path())
+    {
+        existing = existing.parent_path();
+    }
+    // Device-DAX regions are character devices. Anything else lives on a (possibly partitioned) block device.
+    dev_t device = S_ISCHR(info.st_mode) ? info.st_rdev : info.st_dev;
+    std::string base = std::string(S_ISCHR(info.st_mode) ? "/sys/dev/char/" : "/sys/dev/block/") +
+                       std::to_string(major(device)) + ":" + std::to_string(minor(device));
+    for (const std::string &candidate : {base + "/device/numa_node", base + "/../device/numa_node"})
+    {
+        std::ifstream file(candidate);
+        long node;
+        if (file >> node && node >= 0)
+        {
+            return node;
+        }
+    }
+    throw std::runtime_error("cannot find the NUMA node of the device holding " + path);
+}
+
+// Set the memory policy of the calling thread, inherited by every thread it creates afterwards.
+// It covers anonymous memory, such as volatile containers and harness buffers. DAX mapped tables stay where the device is.
+// Policies are "default", "local", "interleave" over every node with memory, and "bind:N" to allocate only from node N.
+// Returns a description of the policy applied.
+inline std::string applyMemoryPolicy(const std::string &policy, const std::string &pmemPath)
+{
+    unsigned long mask = 0;
+    int mode;
+    std::string applied = policy;
+    if (policy == "default")
+    {
+        return policy;
+    }
+    else if (policy == "local")
+    {
+        mode = MPOL_LOCAL;
+    }
+    else if (policy == "interleave")
+    {
+        applied += " on nodes";
+        for (size_t node : numaMemoryNodes())
+        {
+            mask |= node < 8 * sizeof(mask) ? 1UL << node : 0;
+            applied += " " + std::to_string(node);
+        }
+        mode = MPOL_INTERLEAVE;
+    }
+    else if (policy.rfind("bind:", 0) == 0)
+    {
+        std::string target = policy.substr(5);
+        size_t node = target == "pmem" ? pmemNumaNode(pmemPath) : parseCpuList(target).at(0);
+        if (node >= 8 * sizeof(mask))
+        {
+            throw std::runtime_error("NUMA node out of range: " + std::to_string(node));
+        }
+        mask = 1UL << node;
+        mode = MPOL_BIND;
+        applied = "bind to node " + std::to_string(node);
+    }
+    else
+    {
+        throw std::runtime_error("unknown memory policy: " + policy);
+    }
+    if (syscall(SYS_set_mempolicy, mode, mode == MPOL_LOCAL ? nullptr : &mask, mode == MPOL_LOCAL ? 0 : 8 * sizeof(mask) + 1) != 0)
+    {
+        throw std::runtime_error("cannot set memory policy " + policy + ": " + strerror(errno));
+    }
+    return applied;
+}
+
+// Where the pages of a mapping go among the NUMA nodes.
+struct PagePlacement
+{
+    enum Mode
+    {
+        // Wherever the thread that first touches a page runs.
+        FIRST_TOUCH,
+        // Round robin across every node with memory, page by page.
+        INTERLEAVE,
+        // On one node only.
+        BIND
+    };
+    Mode mode = FIRST_TOUCH;
+    // The node for BIND.
+    size_t node = 0;
+
+    // Apply the placement to a range, before its pages are first touched. Pages already present are moved if possible.
+    // Returns false if the kernel refuses, as it does for mappings it cannot place, such as DAX, leaving the range as it was.
+    bool apply(void *address, size_t length) const
+    {
+        if (mode == FIRST_TOUCH || length == 0)
+        {
+            return true;
+        }
+        unsigned long mask = 0;
+        if (mode == INTERLEAVE)
+        {
+            for (size_t n : numaMemoryNodes())
+            {
+                mask |= n < 8 * sizeof(mask) ? 1UL << n : 0;
+            }
+        }
+        else
+        {
+            mask = 1UL << node;
+        }
+        const uintptr_t page = sysconf(_SC_PAGESIZE);
+        uintptr_t first = (uintptr_t)address & ~(page - 1);
+        uintptr_t last = ((uintptr_t)address + length + page - 1) & ~(page - 1);
+        return syscall(SYS_mbind, first, last - first, mode == INTERLEAVE ? MPOL_INTERLEAVE : MPOL_BIND,
+                       &mask, 8 * sizeof(mask) + 1, MPOL_MF_MOVE) == 0;
+    }
+    std::string describe() const
+    {
+        switch (mode)
+        {
+        case INTERLEAVE:
+            return "interleave";
+        case BIND:
+            return "bind:" + std::to_string(node);
+        default:
+            return "first-touch";
+        }
+    }
+};
+
+// Parse a page placement: "first-touch", "interleave", or "bind:N".
+inline PagePlacement parsePagePlacement(const std::string &policy)
+{
+    PagePlacement placement;
+    if (policy == "interleave")
+    {
+        placement.mode = PagePlacement::INTERLEAVE;
+    }
+    else if (policy.rfind("bind:", 0) == 0)
+    {
+        placement.mode = PagePlacement::BIND;
+        std::vector<size_t> nodes = parseCpuList(policy.substr(5));
+        if (nodes.size() != 1 || nodes[0] >= 8 * sizeof(unsigned long))
+        {
+            throw std::runtime_error("bad NUMA node in page placement: " + policy);
+        }
+        placement.node = nodes[0];
+    }
+    else if (policy != "first-touch")
+    {
+        throw std::runtime_error("unknown page placement: " + policy);
+    }
+    return placement;
+}
+
+// Describe where the test threads run, for the results.
+inline void printTopology(std::ostream &stream, const std::vector<size_t> &plan, const std::string &memoryPolicy)
+{
+    stream << "topology: " << numaNodes().size() << " NUMA nodes, " << std::thread::hardware_concurrency() << " CPUs; threads ";
+    if (plan.empty())
+    {
+        stream << "not pinned";
+    }
+    else
+    {
+        stream << "on CPUs (node)";
+        for (size_t t = 0; t < plan.size(); t++)
+        {
+            stream << (t > 0 ? "," : " ") << plan[t] << "(" << cpuNumaNode(plan[t]) << ")";
+        }
+    }
+    stream << "; memory policy: " << memoryPolicy << std::endl;
+}
+
+#endif
@@ -0,0 +1,227 @@
+// Hardware performance counters for the test harness, read through perf_event_open.
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Counters for the calling thread, in two groups: core events, and NUMA node events.
+// Splitting them keeps each group small enough to be scheduled on the hardware at once.
+// Events the CPU or kernel do not support are left out, and reported as unavailable.
+// Only user space is counted, so perf_event_paranoid up to 2 is enough.
+class PerfCounters
+{
+public:
+    enum Event : size_t
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        LLC_MISSES,
+        DTLB_MISSES,
+        // Cycles stalled in the back end, which are mostly memory stalls. Not every CPU has it.
+        STALL_CYCLES,
+        // Loads that went to memory, and those served by a remote NUMA node.
+        NODE_LOADS,
+        REMOTE_LOADS,
+        EVENT_COUNT
+    };
+    // The first event of each group, which leads it.
+    static constexpr Event LEADERS[] = {CYCLES, NODE_LOADS};
+
+    PerfCounters()
+    {
+        for (size_t e = 0; e < EVENT_COUNT; e++)
+        {
+            fds[e] = -1;
+            counts[e] = 0;
+        }
+    }
+    ~PerfCounters()
+    {
+        for (size_t e = 0; e < EVENT_COUNT; e++)
+        {
+            if (fds[e] != -1)
+            {
+                close(fds[e]);
+            }
+        }
+    }
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    // Open the group on the calling thread. Counting starts with start().
+    // Returns false, with the reason in failure(), if not even cycles can be counted.
+    bool open()
+    {
+        for (size_t e = 0; e < EVENT_COUNT; e++)
+        {
+            Event leader = leaderOf((Event)e);
+            fds[e] = openEvent((Event)e, e == leader ? -1 : fds[leader]);
+            if (e == CYCLES && fds[e] == -1)
+            {
+                error = strerror(errno);
+                return false;
+            }
+        }
+        return true;
+    }
+    const std::string &failure() const
+    {
+        return error;
+    }
+    void start()
+    {
+        for (Event leader : LEADERS)
+        {
+            if (fds[leader] != -1)
+            {
+                ioctl(fds[leader], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                ioctl(fds[leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            }
+        }
+    }
+    // Stop counting and read the counts.
+    // If the group had to share the hardware with other groups, the counts are scaled up to the whole time.
+    void stop()
+    {
+        for (Event leader : LEADERS)
+        {
+            if (fds[leader] == -1)
+            {
+                continue;
+            }
+            ioctl(fds[leader], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            // The layout of PERF_FORMAT_GROUP with both times: nr, time_enabled, time_running, then one value per open event.
+            uint64_t values[3 + EVENT_COUNT] = {};
+            if (read(fds[leader], values, sizeof(values)) < (ssize_t)(3 * sizeof(uint64_t)))
+            {
+                continue;
+            }
+            double scale = values[2] > 0 ? (double)values[1] / values[2] : 1;
+            size_t next = 3;
+            for (size_t e = 0; e < EVENT_COUNT; e++)
+            {
+                if (leaderOf((Event)e) == leader && fds[e] != -1 && next < 3 + values[0])
+                {
+                    counts[e] = (uint64_t)(values[next++] * scale);
+                }
+            }
+        }
+    }
+    bool available(Event e) const
+    {
+        return fds[e] != -1;
+    }
+    uint64_t count(Event e) const
+    {
+        return counts[e];
+    }
+    // Add the counts of another thread. Events stay available only if every thread had them.
+    void merge(const PerfCounters &other)
+    {
+        for (size_t e = 0; e < EVENT_COUNT; e++)
+        {
+            counts[e] += other.counts[e];
+        }
+        merged++;
+        for (size_t e = 0; e < EVENT_COUNT; e++)
+        {
+            if (other.fds[e] == -1)
+            {
+                missing[e] = true;
+            }
+        }
+    }
+    // Print the merged counts per operation.
+    void print(std::ostream &stream, const std::string &label, size_t ops) const
+    {
+        static const char *const NAMES[] = {"cycles", "instructions", "LLC misses", "dTLB misses", "stall cycles", "node loads", "remote loads"};
+        stream << label << " hardware counters per op:";
+        for (size_t e = 0; e < EVENT_COUNT; e++)
+        {
+            stream << (e > 0 ? "," : "") << " " << NAMES[e] << " = ";
+            if (missing[e] || merged == 0)
+            {
+                stream << "n/a";
+            }
+            else
+            {
+                stream << (ops > 0 ? (double)counts[e] / ops : 0);
+            }
+        }
+        if (!missing[CYCLES] && !missing[INSTRUCTIONS] && merged > 0 && counts[CYCLES] > 0)
+        {
+            stream << ", IPC = " << (double)counts[INSTRUCTIONS] / counts[CYCLES];
+        }
+        if (!missing[NODE_LOADS] && !missing[REMOTE_LOADS] && merged > 0 && counts[NODE_LOADS] > 0)
+        {
+            stream << ", remote share = " << (double)counts[REMOTE_LOADS] / counts[NODE_LOADS];
+        }
+        stream << std::endl;
+    }
+
+private:
+    static Event leaderOf(Event e)
+    {
+        return e >= NODE_LOADS ? NODE_LOADS : CYCLES;
+    }
+    static int openEvent(Event e, int group)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        switch (e)
+        {
+        case CYCLES:
+            attr.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case INSTRUCTIONS:
+            attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case LLC_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case DTLB_MISSES:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        case STALL_CYCLES:
+            attr.config = PERF_COUNT_HW_STALLED_CYCLES_BACKEND;
+            break;
+        case NODE_LOADS:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_ACCESS << 16);
+            break;
+        default:
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+        }
+        // Only the leader is disabled. Members follow it.
+        attr.disabled = (group == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    int fds[EVENT_COUNT];
+    uint64_t counts[EVENT_COUNT];
+    // Used once merged: events some thread could not count, and how many threads were merged.
+    bool missing[EVENT_COUNT] = {};
+    size_t merged = 0;
+    std::string error;
+};
+
+#endif
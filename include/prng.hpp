@@ -0,0 +1,90 @@
+// Fast pseudo random number generators for workloads, one per thread.
+// The C library's rand() takes a lock, so threads calling it in a timed loop serialize on it.
+#ifndef PRNG_HPP
+#define PRNG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// SplitMix64. Mostly used to seed Xoshiro256 from a single number.
+class SplitMix64
+{
+public:
+    explicit SplitMix64(uint64_t seed) : state(seed)
+    {
+    }
+    uint64_t next()
+    {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t state;
+};
+
+// xoshiro256**, by Blackman and Vigna.
+// Also a standard uniform random bit generator, so it works with <random> distributions.
+class Xoshiro256
+{
+public:
+    using result_type = uint64_t;
+
+    // Generators seeded with different numbers, such as a base seed plus a thread number, give unrelated streams.
+    explicit Xoshiro256(uint64_t seed = 1)
+    {
+        SplitMix64 seeder(seed);
+        for (uint64_t &word : s)
+        {
+            word = seeder.next();
+        }
+    }
+    uint64_t next()
+    {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+    // A number in [0, bound), by Lemire's multiply and shift. The bias is negligible for bounds far below 2^64.
+    uint64_t below(uint64_t bound)
+    {
+        return (uint64_t)(((unsigned __int128)next() * bound) >> 64);
+    }
+    // A number in [0, 1).
+    double uniform()
+    {
+        return (next() >> 11) * 0x1.0p-53;
+    }
+
+    uint64_t operator()()
+    {
+        return next();
+    }
+    static constexpr uint64_t min()
+    {
+        return 0;
+    }
+    static constexpr uint64_t max()
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t s[4];
+};
+
+#endif
@@ -1,5 +1,5 @@
 // This file contains the primary test harness used for all testing.
-// You must specify a test and a data structure.
+// Pick a workload and a container with --workload and --container.
 // You must also specify test parameters, such as thread count and test size.
 // Some tests will override test parameters by necessity (data type, thread count, etc.)
 
@@ -7,8 +7,6 @@
 
 int main(int argc, char **args)
 {
-    test_type *test = new test_type();
-
     std::vector<std::string> arguments(args, args + argc);
     size_t argn = 1;
     bool matched = true;
@@ -16,13 +14,45 @@ int main(int argc, char **args)
 
     while (matched && (argn < arguments.size()))
     {
-        matched = (matchOpt1(arguments, argn, "-t", settings.numthreads) ||
+        matched = (matchOpt1(arguments, argn, "--container", settings.container) ||
+                   matchOpt1(arguments, argn, "--workload", settings.workload) ||
+                   matchOpt1(arguments, argn, "-t", settings.numthreads) ||
                    matchOpt1(arguments, argn, "-n", settings.numops) ||
                    matchOpt1(arguments, argn, "-p", settings.numruns) ||
                    matchOpt1(arguments, argn, "-c", settings.capacity) ||
                    matchOpt1(arguments, argn, "-f", settings.filename) ||
                    matchOpt1(arguments, argn, "-r", settings.recover) ||
                    matchOpt1(arguments, argn, "-w", settings.wipeFile) ||
+                   matchOpt1(arguments, argn, "-d", settings.duration) ||
+                   matchOpt1(arguments, argn, "--warmup", settings.warmup) ||
+                   matchOpt1(arguments, argn, "--pool", settings.poolFile) ||
+                   matchOpt1(arguments, argn, "--pool-size", settings.poolSize) ||
+                   matchOpt1(arguments, argn, "--prealloc", settings.preallocThreshold) ||
+                   matchOpt1(arguments, argn, "--migrators", settings.migrators) ||
+                   matchOpt1(arguments, argn, "--copy-budget", settings.copyBudget) ||
+                   matchOpt1(arguments, argn, "--load-factor", settings.loadFactor) ||
+                   matchOpt1(arguments, argn, "--probe-limit", settings.probeLimit) ||
+                   matchOpt1(arguments, argn, "--growth", settings.growthFactor) ||
+                   matchOpt1(arguments, argn, "--recovery-migrators", settings.recoveryMigrators) ||
+                   matchOpt1(arguments, argn, "--table-placement", settings.tablePlacement) ||
+                   matchOpt1(arguments, argn, "--ycsb-workload", settings.ycsbWorkload) ||
+                   matchOpt1(arguments, argn, "--ycsb-dir", settings.ycsbDir) ||
+                   matchOpt1(arguments, argn, "--ycsb-trace", settings.ycsbTrace) ||
+                   matchOpt1(arguments, argn, "--ycsb-records", settings.ycsbRecords) ||
+                   matchOpt1(arguments, argn, "--ycsb-mix", settings.ycsbMix) ||
+                   matchOpt1(arguments, argn, "--ycsb-dist", settings.ycsbDistribution) ||
+                   matchOpt1(arguments, argn, "--ycsb-theta", settings.ycsbTheta) ||
+                   matchOpt1(arguments, argn, "--ycsb-seed", settings.ycsbSeed) ||
+                   matchOpt1(arguments, argn, "--random-mix", settings.randomMix) ||
+                   matchOpt1(arguments, argn, "--key-range", settings.keyRange) ||
+                   matchOpt1(arguments, argn, "--random-seed", settings.randomSeed) ||
+                   matchOpt0(arguments, argn, "--random-pregen", [&settings]() { settings.randomPregenerate = true; }) ||
+                   matchOpt1(arguments, argn, "--pin", settings.pinning) ||
+                   matchOpt1(arguments, argn, "--mem-policy", settings.memoryPolicy) ||
+                   matchOpt0(arguments, argn, "--keep-migrated", [&settings]() { settings.releaseChunks = false; }) ||
+                   matchOpt0(arguments, argn, "--ycsb-generate", [&settings]() { settings.ycsbGenerate = true; }) ||
+                   matchOpt0(arguments, argn, "--latency", [&settings]() { settings.latency = true; }) ||
+                   matchOpt0(arguments, argn, "--perf", [&settings]() { settings.perf = true; }) ||
                    matchOpt0(arguments, argn, "-h", help, arguments.at(0)));
     }
 
@@ -32,41 +62,17 @@ int main(int argc, char **args)
         exit(1);
     }
 
-    settings.print();
-
-    // Performance results output.
-    std::ofstream output;
-    output.open("output.txt", std::ios::out | std::ios::app);
-
-    try
+    // Dispatch once, into a benchmark specialized for the container and workload.
+    Benchmark benchmark = findBenchmark(settings.container, settings.workload);
+    if (benchmark == nullptr)
     {
-        size_t total_time = 0;
-
-        // Recover before running the tests.
-        if (settings.recover)
-        {
-            recovery_test(test, settings);
-        }
-
-        for (size_t i = 1; i <= settings.numruns; ++i)
-        {
-            std::cout << "\n*****          test: " << i << std::endl;
-            total_time += run_test(test, settings);
-        }
-
-        std::cout << "average time: " << (total_time / settings.numruns) << std::endl;
-        std::cout << std::endl;
-
-        output << total_time << "\t" << settings.numthreads << "\t" << typeid(test_type).name() << "\t" << typeid(container_type).name() << std::endl;
-    }
-    catch (const std::runtime_error &err)
-    {
-        std::cout << "error in test: " << err.what() << std::endl;
-    }
-    catch (...)
-    {
-        std::cout << "error in test..." << std::endl;
+        std::cerr << "unknown container or workload: " << settings.container << ", " << settings.workload << std::endl
+                  << "containers: " << registeredNames(containerNames()) << std::endl
+                  << "workloads: " << registeredNames(workloadNames()) << std::endl;
+        exit(1);
     }
 
-    return 0;
-}
\ No newline at end of file
+    settings.print();
+
+    return benchmark(settings);
+}
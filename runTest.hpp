@@ -7,69 +7,43 @@
 #include <fstream>
 #include <iostream>
 #include <list>
+#include <map>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <vector>
 
-//#define ucfDef
-//#define YCSBTestDef
-
-// Only uncomment PMEM containers when you use them.
+// Containers and workloads are all built into one binary, and picked at runtime with --container and --workload.
+// Only define PMEM containers when you use them: pmDef, onefileDef, clevelDef.
 // Otherwise, they will try to open a PMEM file on persistent memory, even when unused.
 
 #include "containers/ucfMap.hpp"
 //#include "containers/ucfHopscotchMap.hpp"
 #include "containers/stlMap.hpp"
-
-// The container to use.
-#ifdef ucfDef
-using container_type = ucf::container_type;
-#endif
-#ifdef ucfHopscotchDef
-using container_type = ucfHopscotch::container_type;
-#endif
-#ifdef stlDef
-using container_type = stl::container_type;
-#endif
 #ifdef pmDef
 #include "containers/pmemMap.hpp"
-using container_type = pm::container_type;
 #endif
 #ifdef onefileDef
 #include "containers/onefileMap.hpp"
-using container_type = onefile::container_type;
 #endif
 #ifdef clevelDef
 #include "containers/levelMap.hpp"
-using container_type = clevel::container_type;
 #endif
 
+#include "numa.hpp"
+
 #include "tests/alternating.hpp"
+#include "tests/boundary.hpp"
 #include "tests/degree.hpp"
 #include "tests/random.hpp"
 #include "tests/reddit.hpp"
+#include "tests/stress.hpp"
 #include "tests/ycsb.hpp"
 
-// The test to run.
-#ifdef alternatingTestDef
-using test_type = alternatingTest::test_type;
-#endif
-#ifdef degreeTestDef
-using test_type = degreeTest::test_type;
-#endif
-#ifdef redditTestDef
-using test_type = redditTest::test_type;
-#endif
-#ifdef randomTestDef
-using test_type = randomTest::test_type;
-#endif
-#ifdef YCSBTestDef
-using test_type = YCSBTest::test_type;
-#endif
-
 TestOptions::TestOptions()
 {
+    container = "ucf";
+    workload = "random";
     numthreads = 8;
     numops = 40;
     numruns = 1;
@@ -77,6 +51,36 @@ TestOptions::TestOptions()
     filename = "/mnt/pmem/pm1/persist.bin";
     recover = true;
     wipeFile = false;
+    poolFile = "";
+    poolSize = 1024;
+    preallocThreshold = 0;
+    migrators = 0;
+    copyBudget = "unlimited";
+    loadFactor = 0.7;
+    probeLimit = 64;
+    growthFactor = 2;
+    releaseChunks = true;
+    recoveryMigrators = std::thread::hardware_concurrency();
+    tablePlacement = "first-touch";
+    latency = false;
+    perf = false;
+    duration = 0;
+    warmup = 1;
+    ycsbWorkload = "a";
+    ycsbDir = "/home/kenneth/PMap/data/YCSB/";
+    ycsbTrace = "";
+    ycsbGenerate = false;
+    ycsbRecords = 64000;
+    ycsbMix = "";
+    ycsbDistribution = "";
+    ycsbTheta = 0.99;
+    ycsbSeed = 1;
+    randomMix = "1,1,1,1,1,1";
+    keyRange = (size_t)RAND_MAX + 1;
+    randomSeed = 1;
+    randomPregenerate = false;
+    pinning = "none";
+    memoryPolicy = "default";
 }
 
 // This function sets an arbitrarily-sized value in some arbitrary memory location.
@@ -101,7 +105,7 @@ template <class N, class T>
 bool matchOpt1(const std::vector<std::string> &args, N &pos, std::string opt, T &fld)
 {
     std::string arg(args.at(pos));
-    if (arg.find(opt) != 0)
+    if (arg != opt)
         return false;
     ++pos;
     fld = conv<T>(args.at(pos));
@@ -113,23 +117,36 @@ template <class N, class Fn, class... Parms>
 bool matchOpt0(const std::vector<std::string> &args, N &pos, std::string opt, Fn fn, Parms... parms)
 {
     std::string arg(args.at(pos));
-    if (arg.find(opt) != 0)
+    if (arg != opt)
         return false;
     fn(parms...);
     ++pos;
     return true;
 }
 
+static std::string registeredNames(const std::vector<std::string> &names)
+{
+    std::string list;
+    for (const std::string &name : names)
+    {
+        list += (list.empty() ? "" : ", ") + name;
+    }
+    return list;
+}
+
+static std::vector<std::string> containerNames();
+static std::vector<std::string> workloadNames();
+
 static void help(const std::string &executable)
 {
     TestOptions tmp;
     std::cout << "A test harness for associative containers: " << executable << std::endl
-              << "test " << typeid(test_type).name() << std::endl
-              << "container " << typeid(container_type).name() << std::endl
               << std::endl
               << "usage: " << executable << " [arguments]" << std::endl
               << std::endl
               << "arguments:" << std::endl
+              << "--container name  container to test: " << registeredNames(containerNames()) << " (default: " << tmp.container << ")\n"
+              << "--workload name   workload to run: " << registeredNames(workloadNames()) << " (default: " << tmp.workload << ")\n"
               << "-t num   number of threads (default: " << tmp.numthreads << ")\n"
               << "-n num   number of total operations executed (default: " << tmp.numops << ")\n"
               << "-p num   number of parallel runs (default: " << tmp.numruns << ")\n"
@@ -137,23 +154,102 @@ static void help(const std::string &executable)
               << "-f name  path to mmaped files (default: " << tmp.filename << ")\n"
               << "-r bool  whether to run the recovery test or the main test (default: " << tmp.recover << ")\n"
               << "-w bool  whether to wipe or recover the persistent file (default: " << tmp.wipeFile << ")\n"
+              << "-d sec   run for this many seconds after a warmup, rather than for -n operations; 0 disables (default: " << tmp.duration << ")\n"
+              << "--warmup sec      seconds to run before measuring, with -d (default: " << tmp.warmup << ")\n"
+              << "--pool name       back all tables with one preallocated pool file or device-DAX region (default: one file per table)\n"
+              << "--pool-size num   size of a newly created pool in MiB (default: " << tmp.poolSize << ")\n"
+              << "--prealloc num    load at which the next table is prepared in the background, below the load factor, 0 disables (default: " << tmp.preallocThreshold << ")\n"
+              << "--migrators num   number of dedicated table migration threads (default: " << tmp.migrators << ")\n"
+              << "--copy-budget x   migration chunks one operation may help with: unlimited, none, or a number (default: " << tmp.copyBudget << ")\n"
+              << "--load-factor num fraction of table slots holding keys at which a table is resized (default: " << tmp.loadFactor << ")\n"
+              << "--probe-limit num longest probe sequence before a key goes to the overflow stash (default: " << tmp.probeLimit << ")\n"
+              << "--growth num      factor by which each new table is larger than the last, e.g. 1.25 or 1.5 (default: " << tmp.growthFactor << ")\n"
+              << "--keep-migrated   keep old table memory until a migration finishes, rather than releasing it chunk by chunk\n"
+              << "--recovery-migrators num threads that finish interrupted migrations after recovery, 0 leaves them to operations (default: " << tmp.recoveryMigrators << ")\n"
+              << "--table-placement x  NUMA placement of new table pages: first-touch, interleave, or bind:N (default: " << tmp.tablePlacement << ")\n"
+              << "--latency         record and report latency percentiles for each operation type\n"
+              << "--ycsb-workload x YCSB workload to run, a to f (default: " << tmp.ycsbWorkload << ")\n"
+              << "--ycsb-dir name   directory holding the converted YCSB traces, workloadX.trace (default: " << tmp.ycsbDir << ")\n"
+              << "--ycsb-trace name YCSB trace to run instead of the workload's trace, converted with tools/ycsbConvert.cpp\n"
+              << "--ycsb-generate   generate the YCSB workload in process, with -n run phase operations, instead of reading a trace\n"
+              << "--ycsb-records num records loaded before a generated run (default: " << tmp.ycsbRecords << ")\n"
+              << "--ycsb-mix r,u,i,m proportions of reads, updates, inserts and read-modify-writes (default: the workload's)\n"
+              << "--ycsb-dist name  request distribution: uniform, zipfian, latest or hotspot (default: the workload's)\n"
+              << "--ycsb-theta num  skew of the zipfian and latest distributions (default: " << tmp.ycsbTheta << ")\n"
+              << "--ycsb-seed num   seed of a generated workload (default: " << tmp.ycsbSeed << ")\n"
+              << "--random-mix w,.. weights of insert, erase, contains, get, count and increment in the random workload (default: " << tmp.randomMix << ")\n"
+              << "--key-range num   draw random workload keys from 1 to num (default: " << tmp.keyRange << ")\n"
+              << "--random-seed num seed of the random and stress workloads (default: " << tmp.randomSeed << ")\n"
+              << "--random-pregen   draw the random workload's operations before the timed run, rather than in it\n"
+              << "--pin policy      pin test threads: none, compact (fill a node first), scatter (round robin over nodes), or a CPU list like 0-3,8 (default: " << tmp.pinning << ")\n"
+              << "--mem-policy x    allocate anonymous memory: default, local, interleave, bind:N, or bind:pmem for the node of the PMEM device (default: " << tmp.memoryPolicy << ")\n"
+              << "--perf            count cycles, instructions, LLC and dTLB misses and remote NUMA loads per operation with hardware counters\n"
               << "-h       displays this help message\n"
               << std::endl;
     exit(0);
 }
 
+// Run the test's prefill on every thread and report its throughput, if it did anything.
+template <class test_type, class container_type>
+void run_prefill(test_type *test, container_type *contptr, const TestOptions &opt, const std::vector<size_t> &pinning)
+{
+    std::list<std::thread> prefill_threads;
+    std::vector<ThreadInfo> thread_info(opt.numthreads, ThreadInfo{});
+    std::vector<ThreadProgress> progress(opt.numthreads);
+
+    test->waiting_threads = opt.numthreads;
+    for (size_t i = 0; i < opt.numthreads; ++i)
+    {
+        ThreadInfo &ti = thread_info.at(i);
+        ti = ThreadInfo(contptr, i, opt.numops, opt.numthreads);
+        ti.progress = &progress.at(i);
+        ti.cpu = pinning.empty() ? -1 : (int)pinning.at(i);
+        prefill_threads.emplace_back(&test_type::pprefill, test, std::ref(ti));
+    }
+    while (test->waiting_threads.load())
+    {
+    }
+    time_point starttime = std::chrono::steady_clock::now();
+    for (std::thread &thr : prefill_threads)
+        thr.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+
+    size_t ops = 0;
+    for (const ThreadProgress &thread : progress)
+    {
+        ops += thread.ops.load();
+    }
+    if (ops > 0)
+    {
+        std::cout << "prefill time = " << (size_t)(seconds * 1000) << "ms" << std::endl
+                  << "prefill throughput = " << (seconds > 0 ? ops / seconds / 1e6 : 0) << " Mops/s (" << ops << " ops)" << std::endl;
+    }
+}
+
+template <class test_type, class container_type>
 int run_test(test_type *test, const TestOptions &opt)
 {
     std::cout << std::endl;
 
     std::list<std::thread> exp_threads;
     std::vector<ThreadInfo> thread_info(opt.numthreads, ThreadInfo{});
+    std::vector<OpLatencies> latencies(opt.latency ? opt.numthreads : 0);
+    if (opt.latency)
+    {
+        // Calibrate the time stamp counter now, rather than while printing.
+        tscNanosPerTick();
+    }
+    std::vector<PerfCounters> perfCounters(opt.perf ? opt.numthreads : 0);
+    std::vector<size_t> pinning = pinningPlan(opt.pinning, opt.numthreads);
     container_type *contptr = new container_type(opt, opt.recover);
 
     ThreadInfo *tmpThreadInfo = new ThreadInfo(contptr, 0, opt.numops, opt.numthreads);
     test->container_test_prefix(*tmpThreadInfo);
+    run_prefill(test, contptr, opt, pinning);
 
-    time_point starttime;
+    std::vector<ThreadProgress> progress(opt.numthreads);
+    // Tells the threads to stop, in duration mode.
+    std::atomic<bool> stop{false};
 
     // Used to start all threads at the same time.
     test->waiting_threads = opt.numthreads;
@@ -163,20 +259,113 @@ int run_test(test_type *test, const TestOptions &opt)
     {
         ThreadInfo &ti = thread_info.at(i);
 
-        ti = ThreadInfo(contptr, i, opt.numops, opt.numthreads);
-        exp_threads.emplace_back(&test_type::ptest, test, std::ref(ti), std::ref(starttime));
+        ti = ThreadInfo(contptr, i, opt.numops, opt.numthreads, opt.latency ? &latencies.at(i) : nullptr,
+                        opt.perf ? &perfCounters.at(i) : nullptr);
+        ti.progress = &progress.at(i);
+        ti.stop = opt.duration > 0 ? &stop : nullptr;
+        ti.cpu = pinning.empty() ? -1 : (int)pinning.at(i);
+        exp_threads.emplace_back(&test_type::ptest, test, std::ref(ti));
+    }
+
+    // The clock starts once every thread has been released.
+    while (test->waiting_threads.load())
+    {
+    }
+    time_point starttime = std::chrono::steady_clock::now();
+
+    // The measured window, and the operations each thread completed before it.
+    time_point measureStart = starttime;
+    time_point measureEnd;
+    std::vector<size_t> opsBefore(opt.numthreads, 0);
+    std::vector<size_t> opsAfter(opt.numthreads, 0);
+    if (opt.duration > 0)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<double>(opt.warmup));
+        measureStart = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < opt.numthreads; ++i)
+        {
+            opsBefore[i] = progress[i].ops.load();
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(opt.duration));
+        measureEnd = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < opt.numthreads; ++i)
+        {
+            opsAfter[i] = progress[i].ops.load();
+        }
+        stop.store(true);
     }
 
     // join
     for (std::thread &thr : exp_threads)
         thr.join();
 
-    time_point endtime = std::chrono::system_clock::now();
+    time_point endtime = std::chrono::steady_clock::now();
     int elapsedtime = std::chrono::duration_cast<duration_unit>(endtime - starttime).count();
 
+    // Without a duration, each thread is measured from the start until it finished.
+    size_t totalOps = 0;
+    // Per thread rates, each over the thread's own window.
+    double slowest = 0;
+    double fastest = 0;
+    double rateSum = 0;
+    for (size_t i = 0; i < opt.numthreads; ++i)
+    {
+        double seconds;
+        if (opt.duration > 0)
+        {
+            seconds = std::chrono::duration<double>(measureEnd - measureStart).count();
+        }
+        else
+        {
+            opsAfter[i] = progress[i].ops.load();
+            seconds = (progress[i].finished.load() - std::chrono::duration_cast<std::chrono::nanoseconds>(starttime.time_since_epoch()).count()) / 1e9;
+        }
+        size_t ops = opsAfter[i] - opsBefore[i];
+        totalOps += ops;
+        double rate = seconds > 0 ? ops / seconds / 1e6 : 0;
+        slowest = i == 0 ? rate : std::min(slowest, rate);
+        fastest = i == 0 ? rate : std::max(fastest, rate);
+        rateSum += rate;
+    }
+    double measured = std::chrono::duration<double>((opt.duration > 0 ? measureEnd : endtime) - measureStart).count();
+
     const int actsize = contptr->count();
     std::cout << "elapsed time = " << elapsedtime << "ms" << std::endl;
+    std::cout << "throughput = " << (measured > 0 ? totalOps / measured / 1e6 : 0) << " Mops/s (" << totalOps << " ops in " << measured << "s"
+              << "; per thread: min = " << slowest << ", mean = " << rateSum / opt.numthreads
+              << ", max = " << fastest << " Mops/s)" << std::endl;
     std::cout << "container size = " << actsize << std::endl;
+    printContainerStats(*contptr, std::cout);
+    if (opt.latency)
+    {
+        OpLatencies all;
+        for (const OpLatencies &latency : latencies)
+        {
+            all.merge(latency);
+        }
+        all.print(std::cout);
+    }
+    if (opt.perf)
+    {
+        PerfCounters all;
+        for (const PerfCounters &counters : perfCounters)
+        {
+            all.merge(counters);
+        }
+        if (!perfCounters.front().failure().empty())
+        {
+            std::cout << "hardware counters unavailable: " << perfCounters.front().failure() << std::endl;
+        }
+        else
+        {
+            size_t countedOps = 0;
+            for (const ThreadProgress &thread : progress)
+            {
+                countedOps += thread.ops.load();
+            }
+            all.print(std::cout, opt.workload + " on " + opt.container, countedOps);
+        }
+    }
 
     std::cerr << elapsedtime << std::endl;
 
@@ -189,6 +378,7 @@ int run_test(test_type *test, const TestOptions &opt)
 }
 
 // Test to ensure that the data structure persisted to a recoverable state.
+template <class test_type, class container_type>
 int recovery_test(test_type *test, const TestOptions &opt)
 {
     // Recover the container.
@@ -207,4 +397,124 @@ int recovery_test(test_type *test, const TestOptions &opt)
     return 0;
 }
 
+// Run one workload on one container, as many times as asked, and append the results to output.txt.
+// Everything below this is specialized for the pair, so container calls are not virtual.
+template <class test_type, class container_type>
+int run_benchmark(const TestOptions &settings)
+{
+    test_type *test = new test_type();
+
+    // Performance results output.
+    std::ofstream output;
+    output.open("output.txt", std::ios::out | std::ios::app);
+
+    try
+    {
+        size_t total_time = 0;
+        test->configure(settings);
+
+        // Set before anything is allocated, so every thread created from here on inherits it.
+        std::string memoryPolicy = applyMemoryPolicy(settings.memoryPolicy, settings.poolFile.empty() ? settings.filename : settings.poolFile);
+        printTopology(std::cout, pinningPlan(settings.pinning, settings.numthreads), memoryPolicy);
+
+        // Recover before running the tests.
+        if (settings.recover)
+        {
+            recovery_test<test_type, container_type>(test, settings);
+        }
+
+        for (size_t i = 1; i <= settings.numruns; ++i)
+        {
+            std::cout << "\n*****          test: " << i << std::endl;
+            total_time += run_test<test_type, container_type>(test, settings);
+        }
+
+        std::cout << "average time: " << (total_time / settings.numruns) << std::endl;
+        std::cout << std::endl;
+
+        output << total_time << "\t" << settings.numthreads << "\t" << settings.workload << "\t" << settings.container
+               << "\t" << settings.pinning << "\t" << settings.memoryPolicy << std::endl;
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cout << "error in test: " << err.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cout << "error in test..." << std::endl;
+    }
+
+    delete test;
+    return 0;
+}
+
+// A benchmark for one workload on one container.
+using Benchmark = int (*)(const TestOptions &);
+
+// Every workload, specialized for one container.
+template <Container container_type>
+static std::map<std::string, Benchmark> workloads()
+{
+    return {
+        {"alternating", &run_benchmark<alternatingTest::test_type<container_type>, container_type>},
+        {"boundary", &run_benchmark<boundaryTest::test_type<container_type>, container_type>},
+        {"degree", &run_benchmark<degreeTest::test_type<container_type>, container_type>},
+        {"random", &run_benchmark<randomTest::test_type<container_type>, container_type>},
+        {"reddit", &run_benchmark<redditTest::test_type<container_type>, container_type>},
+        {"stress", &run_benchmark<stressTest::test_type<container_type>, container_type>},
+        {"ycsb", &run_benchmark<YCSBTest::test_type<container_type>, container_type>},
+    };
+}
+
+// Every container built into this binary, with its workloads.
+static const std::map<std::string, std::map<std::string, Benchmark>> &registry()
+{
+    static const std::map<std::string, std::map<std::string, Benchmark>> containers = {
+        {"ucf", workloads<ucf::container_type>()},
+        {"stl", workloads<stl::container_type>()},
+#ifdef pmDef
+        {"pm", workloads<pm::container_type>()},
+#endif
+#ifdef onefileDef
+        {"onefile", workloads<onefile::container_type>()},
+#endif
+#ifdef clevelDef
+        {"clevel", workloads<clevel::container_type>()},
+#endif
+    };
+    return containers;
+}
+
+static std::vector<std::string> containerNames()
+{
+    std::vector<std::string> names;
+    for (auto &container : registry())
+    {
+        names.push_back(container.first);
+    }
+    return names;
+}
+
+static std::vector<std::string> workloadNames()
+{
+    std::vector<std::string> names;
+    for (auto &workload : registry().begin()->second)
+    {
+        names.push_back(workload.first);
+    }
+    return names;
+}
+
+// The benchmark for a container and workload, or nullptr if either is unknown.
+static Benchmark findBenchmark(const std::string &container, const std::string &workload)
+{
+    auto containers = registry().find(container);
+    if (containers == registry().end())
+    {
+        return nullptr;
+    }
+    auto benchmark = containers->second.find(workload);
+    return benchmark == containers->second.end() ? nullptr : benchmark->second;
+}
+
 #endif
\ No newline at end of file
@@ -1,15 +1,18 @@
 #!/bin/bash
 
-DATA_STRUCTURES=(ucfDef clevelDef stlDef pmDef onefileDef)
-TESTS=(YCSBTestDef alternatingTestDef degreeTestDef randomTestDef redditTestDef)
+DATA_STRUCTURES=(ucf clevel stl pm onefile)
+TESTS=(ycsb alternating degree random reddit)
+
+# Every container and workload is built into one binary.
+make clean && make DEFINES="-DclevelDef -DpmDef -DonefileDef"
 
 for t in "${TESTS[@]}";
 do
     for ds in "${DATA_STRUCTURES[@]}";
     do
-        if [[ $t = "degreeTestDef" ]]; then
+        if [[ $t = "degree" ]]; then
             MAX=4
-        elif [[ $t = "redditTestDef" ]]; then
+        elif [[ $t = "reddit" ]]; then
             MAX=1
         else
             MAX=80
@@ -17,15 +20,14 @@ do
 
         for ((i=1;i<=MAX;i++));
         do
-            make clean && make DEFINES="-D$ds -D$t"
-            if [[ $ds = "pmDef" ]]; then
+            if [[ $ds = "pm" ]]; then
                 pmempool create obj --layout="cmap" --size 1G /mnt/pmem/pm1/persistFile.bin
             fi
-            if [[ $ds = "clevelDef" ]]; then
+            if [[ $ds = "clevel" ]]; then
                 pmempool create obj --layout="clevel_hash" --size 1G /mnt/pmem/pm1/persistFile.bin
             fi
             # 2^14 is the initial capacity of level hashing. Match it for other structures here.
-            ./bin/test.out -t $i -n 50000 -p 1 -c 14 -f /mnt/pmem/pm1/persist.bin -r 0 -w 0
+            ./bin/test.out --container $ds --workload $t -t $i -n 50000 -p 1 -c 14 -f /mnt/pmem/pm1/persist.bin -r 0 -w 0
         done
     done
 done
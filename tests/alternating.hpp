@@ -7,9 +7,20 @@
 // Preinserts elements, then alternates random insertions and removals.
 namespace alternatingTest
 {
-    struct test_type : Test
+    template <Container container_type>
+    struct test_type final : Test
     {
-        void container_test_prefix(ThreadInfo &ti)
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
+        {
+            return *static_cast<container_type *>(ti.container);
+        }
+        void container_test_prefix(__attribute__((unused)) ThreadInfo &ti)
+        {
+            return;
+        }
+        // Each thread inserts the elements its main loop starts from.
+        void container_test_prefill(ThreadInfo &ti)
         {
             const size_t tinum = ti.num;
             const size_t maxops = opsPerThread(ti.num_threads, ti.pnoiter, 0);
@@ -22,12 +33,11 @@ namespace alternatingTest
                 while (numops > nummain)
                 {
                     int elem = genElem(wrid, tinum, ti.num_threads, maxops);
-                    int succ = ((container_type *)ti.container)->insert(elem);
-
-                    assert(succ >= 0);
+                    container(ti).insert(elem);
                     ++ti.succ;
                     ++wrid;
-                    // std::cout << "insert' " << elem << " " << succ << std::endl;
+                    op_done(ti);
+                    // std::cout << "insert' " << elem << std::endl;
 
                     --numops;
                 }
@@ -50,22 +60,22 @@ namespace alternatingTest
             try
             {
                 // set numops to nummain (after prefix has been executed)
-                while (nummain)
+                // Each element is only used once, so a test running for a duration may still run out of operations first.
+                while (nummain && !stopped(ti))
                 {
+                    LatencyTimer timer(ti.latency, nummain % 2 ? OpType::INSERT : OpType::ERASE);
                     if (nummain % 2)
                     {
                         int elem = genElem(wrid, tinum, ti.num_threads, maxops);
-                        int succ = ((container_type *)ti.container)->insert(elem);
-
-                        assert(succ >= 0);
+                        container(ti).insert(elem);
                         ++wrid;
                         ++ti.succ;
-                        // std::cout << "insert " << elem << " " << succ << std::endl;
+                        // std::cout << "insert " << elem << std::endl;
                     }
                     else
                     {
                         int elem = genElem(rdid, tinum, ti.num_threads, maxops);
-                        int succ = ((container_type *)ti.container)->erase(elem);
+                        int succ = container(ti).erase(elem);
 
                         ++rdid;
                         if (succ > 0)
@@ -75,6 +85,7 @@ namespace alternatingTest
                         // std::cout << "erase " << elem << " " << succ << std::endl;
                     }
 
+                    op_done(ti);
                     --nummain;
                 }
 
@@ -141,7 +152,7 @@ namespace alternatingTest
                     const checked_elem_t val = genElemChecked(opid, ti.num, ti.num_threads, maxops);
 
                     assert(val.second);
-                    if (((container_type *)ti.container)->contains(val.first))
+                    if (container(ti).contains(val.first))
                     {
                         ++numvalid;
                         // std::cerr << val << std::endl;
@@ -159,7 +170,7 @@ namespace alternatingTest
             {
                 checked_elem_t val = genElemChecked(rdid, ti.num, ti.num_threads, maxops);
 
-                while (val.second && !((container_type *)ti.container)->contains(val.first))
+                while (val.second && !container(ti).contains(val.first))
                 {
                     ++rdid;
                     val = genElemChecked(rdid, ti.num, ti.num_threads, maxops);
@@ -173,7 +184,7 @@ namespace alternatingTest
                 size_t cntsequ = 0;
                 checked_elem_t val = genElemChecked(rdid, ti.num, ti.num_threads, maxops);
 
-                while (val.second && ((container_type *)ti.container)->contains(val.first))
+                while (val.second && container(ti).contains(val.first))
                 {
                     // std::cerr << val << std::endl;
                     ++cntsequ;
@@ -212,7 +223,7 @@ namespace alternatingTest
                     const checked_elem_t val = genElemChecked(opid, ti.num, ti.num_threads, maxops);
 
                     assert(val.second);
-                    if (((container_type *)ti.container)->contains(val.first))
+                    if (container(ti).contains(val.first))
                     {
                         success = false;
                         // std::cerr << "unexpected " << val << std::endl;
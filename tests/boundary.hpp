@@ -0,0 +1,175 @@
+#ifndef BOUNDARY_HPP
+#define BOUNDARY_HPP
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "test.hpp"
+
+// A deterministic migration test, for containers built on the cliff map.
+// Places a pair of keys at the end of every chunk of an empty table, the second displaced by the first into the next chunk.
+// Then migrates the table one chunk at a time, in a set order, wrapping around, and after every chunk
+// looks up each displaced key whose home chunk is done while its own chunk is not.
+// Each must be found in place, without the lookup falling through to the new table and moving the migration on.
+// Run it with no migrators, so nothing else copies chunks.
+namespace boundaryTest
+{
+    template <Container container_type>
+    struct test_type final : Test
+    {
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
+        {
+            return *static_cast<container_type *>(ti.container);
+        }
+        // The keys at the end of each chunk, and the keys they displaced into the next one.
+        std::vector<KeyT> homed;
+        std::vector<KeyT> displaced;
+        // Lookups made, and those that went wrong.
+        size_t lookups = 0;
+        size_t failures = 0;
+        // Set if the migration did not go as the test drove it.
+        std::string error;
+
+        void configure(const TestOptions &opt)
+        {
+            if (opt.migrators != 0)
+            {
+                throw std::runtime_error("the boundary workload copies chunks itself, so it needs --migrators 0");
+            }
+        }
+        void container_test_prefix(ThreadInfo &ti)
+        {
+            if constexpr (requires(container_type &c) { c.c->migrateChunk(0); })
+            {
+                place(container(ti).c);
+            }
+            else
+            {
+                throw std::runtime_error("the boundary workload needs a container built on the cliff map");
+            }
+        }
+        void container_test(ThreadInfo &ti)
+        {
+            if constexpr (requires(container_type &c) { c.c->migrateChunk(0); })
+            {
+                if (ti.num == 0)
+                {
+                    migrate(container(ti).c, ti);
+                }
+            }
+        }
+        void container_test_suffix(__attribute__((unused)) ThreadInfo &ti)
+        {
+            if (!error.empty())
+            {
+                throw std::runtime_error("boundary test: " + error);
+            }
+            if (failures > 0)
+            {
+                throw std::runtime_error("boundary test: " + std::to_string(failures) + " of " + std::to_string(lookups) + " lookups missed");
+            }
+            std::cout << "boundary test: all " << lookups << " lookups found their keys" << std::endl;
+            return;
+        }
+
+        // The number of chunks holding slots of the main table, which probes wrap around.
+        template <class Map>
+        static size_t mainChunks(typename Map::Table *table)
+        {
+            return (table->len + table->header->chunkSize - 1) / table->header->chunkSize;
+        }
+        // Two keys at the end of every chunk. The first takes the last slot, the second the first slot of the next chunk.
+        template <class Map>
+        void place(Map *map)
+        {
+            typename Map::Table *table = map->currentTable();
+            if (map->size() != 0 || table->chm.newTable.load() != nullptr)
+            {
+                throw std::runtime_error("the boundary workload needs an empty table");
+            }
+            const size_t chunks = mainChunks<Map>(table);
+            if (chunks < 2)
+            {
+                throw std::runtime_error("the boundary workload needs a table of at least two chunks; raise the capacity");
+            }
+            homed.assign(chunks, 0);
+            displaced.assign(chunks, 0);
+            KeyT n = 0;
+            for (size_t chunk = 0; chunk < chunks; chunk++)
+            {
+                size_t home = std::min((chunk + 1) * table->header->chunkSize, table->len) - 1;
+                for (KeyT *key : {&homed[chunk], &displaced[chunk]})
+                {
+                    do
+                    {
+                        *key = ++n << Map::BITS_MARKED;
+                    } while (Map::isKeyReserved(*key) || table->home(Map::hashKey(*key)) != home);
+                    map->put(*key, *key);
+                }
+                if (table->key(home) != homed[chunk] || table->key(table->next(home)) != displaced[chunk])
+                {
+                    throw std::runtime_error("the boundary workload could not place its keys");
+                }
+            }
+        }
+        // Migrate the stash first, as helpers do, then the main chunks from the last one around.
+        template <class Map>
+        void migrate(Map *map, ThreadInfo &ti)
+        {
+            typename Map::Table *table = map->currentTable();
+            const size_t chunks = mainChunks<Map>(table);
+            std::vector<size_t> order;
+            for (size_t chunk = table->len / table->header->chunkSize; chunk < table->header->chunkCount; chunk++)
+            {
+                order.push_back(chunk);
+            }
+            for (size_t i = 0; i < chunks; i++)
+            {
+                order.push_back((chunks - 1 + i) % chunks);
+            }
+            std::vector<bool> copied(table->header->chunkCount, false);
+            for (size_t step = 0; step + 1 < order.size(); step++)
+            {
+                map->migrateChunk(order[step]);
+                copied[order[step]] = true;
+                for (size_t chunk = 0; chunk < chunks; chunk++)
+                {
+                    if (copied[chunk] && !copied[(chunk + 1) % chunks])
+                    {
+                        lookups++;
+                        failures += map->get(displaced[chunk]) != displaced[chunk];
+                        op_done(ti);
+                    }
+                }
+                // A lookup that fell through to the new table would have helped copy more.
+                for (size_t chunk = 0; chunk < copied.size(); chunk++)
+                {
+                    if ((table->chunkState(chunk).load() == Map::CHUNK_DONE) != copied[chunk])
+                    {
+                        error = "a lookup fell through to the new table after " + std::to_string(step + 1) + " chunks";
+                        return;
+                    }
+                }
+            }
+            map->migrateChunk(order.back());
+            if (map->currentTable() == table)
+            {
+                error = "the migration did not finish";
+                return;
+            }
+            // Every key must have come through the migration.
+            for (size_t chunk = 0; chunk < chunks; chunk++)
+            {
+                lookups += 2;
+                failures += map->get(homed[chunk]) != homed[chunk];
+                failures += map->get(displaced[chunk]) != displaced[chunk];
+                op_done(ti);
+                op_done(ti);
+            }
+        }
+    };
+} // namespace boundaryTest
+
+#endif
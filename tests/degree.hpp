@@ -9,17 +9,23 @@
 // In structures that cannot count, simply records existance of an outbound connection of a node.
 namespace degreeTest
 {
-    struct test_type : Test
+    template <Container container_type>
+    struct test_type final : Test
     {
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
+        {
+            return *static_cast<container_type *>(ti.container);
+        }
     private:
         static void reportDegree(ThreadInfo &ti)
         {
-            size_t elemCount = ((container_type *)ti.container)->count();
+            size_t elemCount = container(ti).count();
             for (size_t i = 0; i < elemCount; i++)
             {
-                if (((container_type *)ti.container)->contains(i))
+                if (container(ti).contains(i))
                 {
-                    std::cout << "Node  " << i << ":\t" << ((container_type *)ti.container)->get(i) << std::endl;
+                    std::cout << "Node  " << i << ":\t" << container(ti).get(i) << std::endl;
                 }
             }
         }
@@ -39,7 +45,7 @@ namespace degreeTest
             KeyT outgoing;
             KeyT incoming;
             size_t val;
-            while (std::getline(rmat, line))
+            while (!stopped(ti) && std::getline(rmat, line))
             {
                 std::stringstream ss(line);
                 size_t colIdx = 0;
@@ -61,7 +67,8 @@ namespace degreeTest
                         ss.ignore();
                     colIdx++;
                 }
-                ((container_type *)ti.container)->increment(incoming);
+                container(ti).increment(incoming);
+                op_done(ti);
             }
         }
 
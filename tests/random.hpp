@@ -1,34 +1,145 @@
 #ifndef RANDOM_HPP
 #define RANDOM_HPP
 
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "prng.hpp"
 #include "test.hpp"
 
 // A random test.
 // Preinserts elements equal to roughly half of the number of random operations performed.
-// Randomly runs all available operations.
+// Randomly runs all available operations, in proportions given on the command line, on keys from a given range.
 // Good for finding crash scenarios.
+// Every thread draws from its own generator, seeded from the test seed, so threads never contend on the C library's rand().
 namespace randomTest
 {
-    struct test_type : Test
+    // Operations, in the order their weights are given on the command line.
+    enum Op : uint64_t
     {
+        INSERT,
+        ERASE,
+        CONTAINS,
+        GET,
+        COUNT,
+        INCREMENT,
+        OPS
+    };
+    // A drawn operation is packed above its key, which keeps pre-generated streams to 8 bytes per operation.
+    static const unsigned OP_SHIFT = 56;
+    static const uint64_t KEY_MASK = ((uint64_t)1 << OP_SHIFT) - 1;
+
+    template <Container container_type>
+    struct test_type final : Test
+    {
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
+        {
+            return *static_cast<container_type *>(ti.container);
+        }
+        // The cumulative probability of each operation.
+        double cumulative[OPS];
+        // Keys are drawn from [1, keyRange].
+        uint64_t keyRange = 0;
+        uint64_t seed = 1;
+        // Whether to draw every thread's operations before the test starts, and the streams drawn.
+        bool pregenerate = false;
+        std::vector<std::vector<uint64_t>> streams;
+
+        void configure(const TestOptions &opt)
+        {
+            std::stringstream stream(opt.randomMix);
+            std::string field;
+            double weights[OPS];
+            double total = 0;
+            size_t n = 0;
+            while (std::getline(stream, field, ','))
+            {
+                char *end;
+                double weight = strtod(field.c_str(), &end);
+                if (n == OPS || end == field.c_str() || weight < 0)
+                {
+                    n = OPS + 1;
+                    break;
+                }
+                weights[n++] = weight;
+                total += weight;
+            }
+            if (n != OPS || total <= 0)
+            {
+                throw std::runtime_error("a random mix is six weights, insert,erase,contains,get,count,increment: " + opt.randomMix);
+            }
+            double sum = 0;
+            for (size_t op = 0; op < OPS; op++)
+            {
+                sum += weights[op];
+                cumulative[op] = sum / total;
+            }
+            if (opt.keyRange == 0 || opt.keyRange > KEY_MASK)
+            {
+                throw std::runtime_error("the key range must be between 1 and 2^56");
+            }
+            keyRange = opt.keyRange;
+            seed = opt.randomSeed;
+            pregenerate = opt.randomPregenerate;
+        }
+        // The generator of one thread, for one phase of the test.
+        Xoshiro256 generator(size_t thread, size_t phase) const
+        {
+            return Xoshiro256(seed * 0x9e3779b97f4a7c15 + (thread << 1) + phase);
+        }
+        // Draw an operation, packed with its key.
+        uint64_t draw(Xoshiro256 &rng) const
+        {
+            double u = rng.uniform();
+            uint64_t op = 0;
+            while (op + 1 < OPS && u >= cumulative[op])
+            {
+                op++;
+            }
+            return (op << OP_SHIFT) | (1 + rng.below(keyRange));
+        }
+        // Draw every thread's operations, in parallel, before the threads start.
         void container_test_prefix(ThreadInfo &ti)
         {
-            size_t numops = ti.pnoiter;
+            if (!pregenerate)
+            {
+                return;
+            }
+            streams.assign(ti.num_threads, {});
+            std::vector<std::thread> generators;
+            for (size_t t = 0; t < ti.num_threads; t++)
+            {
+                generators.emplace_back([this, &ti, t]()
+                                        {
+                                            Xoshiro256 rng = generator(t, 1);
+                                            std::vector<uint64_t> &ops = streams[t];
+                                            ops.resize(opsPerThread(ti.num_threads, ti.pnoiter, t));
+                                            for (uint64_t &op : ops)
+                                            {
+                                                op = draw(rng);
+                                            }
+                                        });
+            }
+            for (std::thread &thread : generators)
+            {
+                thread.join();
+            }
+            return;
+        }
+        void container_test_prefill(ThreadInfo &ti)
+        {
+            const size_t numops = opsPerThread(ti.num_threads, ti.pnoiter, ti.num);
+            Xoshiro256 rng = generator(ti.num, 0);
             for (size_t i = 0; i < numops; i++)
             {
                 // 50% prefill.
-                if (rand() % 2)
+                if (rng.next() & 1)
                 {
-                    // Pick a random key/value.
-                    size_t val = rand();
-                    // UCF hash map has some reserved values that cannot be used.
-                    if (typeid(container_type) == typeid(ucf::container_type))
-                        // Keep trying until we fetch a non-reserved value.
-                        while (ConcurrentHashMap<size_t, size_t>::isValueReserved(val << 3) || ConcurrentHashMap<size_t, size_t>::isKeyReserved(val << 3))
-                        {
-                            val = rand();
-                        }
-                    ((container_type *)ti.container)->insert(val);
+                    container(ti).insert(1 + rng.below(keyRange));
+                    op_done(ti);
                 }
             }
             return;
@@ -36,47 +147,50 @@ namespace randomTest
         void container_test(ThreadInfo &ti)
         {
             const size_t numops = opsPerThread(ti.num_threads, ti.pnoiter, ti.num);
+            Xoshiro256 rng = generator(ti.num, 1);
+            const std::vector<uint64_t> *stream = pregenerate ? &streams[ti.num] : nullptr;
+            if (stream != nullptr && stream->empty())
+            {
+                return;
+            }
+            static const OpType TYPES[] = {OpType::INSERT, OpType::ERASE, OpType::CONTAINS, OpType::GET, OpType::COUNT, OpType::INCREMENT};
 
             // TODO: Consider logging these results.
-            for (size_t i = 0; i < numops; i++)
+            // In duration mode, a pre-generated stream is replayed until the test is stopped.
+            for (size_t i = 0; keep_going(ti, i, numops); i++)
             {
-                // Pick a random key/value.
-                size_t val = rand();
-                // UCF hash map has some reserved values that cannot be used.
-                if (typeid(container_type) == typeid(ucf::container_type))
-                    // Keep trying until we fetch a non-reserved value.
-                    while (ConcurrentHashMap<size_t, size_t>::isValueReserved(val) || ConcurrentHashMap<size_t, size_t>::isKeyReserved(val))
-                    {
-                        val = rand();
-                    }
-                // TODO: Consider not performing rand() on the threads, and instead pre-calculate them.
-                switch (rand() % 8)
+                const uint64_t drawn = stream != nullptr ? (*stream)[i % stream->size()] : draw(rng);
+                const KeyT key = drawn & KEY_MASK;
+                const Op op = (Op)(drawn >> OP_SHIFT);
+                LatencyTimer timer(ti.latency, TYPES[op]);
+                switch (op)
                 {
-                case 0:
+                case INSERT:
                     // Insert a value.
-                    ((container_type *)ti.container)->insert(val);
+                    container(ti).insert(key);
                     break;
-                case 1:
+                case ERASE:
                     // Remove the value associated with this key.
-                    ((container_type *)ti.container)->erase(val);
+                    container(ti).erase(key);
                     break;
-                case 2:
+                case CONTAINS:
                     // Check to see if there is a value associated with a specific key.
-                    ((container_type *)ti.container)->contains(val);
+                    container(ti).contains(key);
                     break;
-                case 3:
+                case GET:
                     // Get the value currently associated with the current key.
-                    ((container_type *)ti.container)->get(val);
+                    container(ti).get(key);
                     break;
-                case 4:
+                case COUNT:
                     // Get the size of the hash map.
-                    ((container_type *)ti.container)->count();
+                    container(ti).count();
                     break;
-                case 5:
+                default:
                     // Increment the current value by 1.
-                    ((container_type *)ti.container)->increment(val);
+                    container(ti).increment(key);
                     break;
                 }
+                op_done(ti);
             }
         }
         void container_test_suffix(__attribute__((unused)) ThreadInfo &ti)
@@ -86,4 +200,4 @@ namespace randomTest
     };
 } // namespace randomTest
 
-#endif
\ No newline at end of file
+#endif
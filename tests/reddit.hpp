@@ -9,17 +9,23 @@
 // In structures that cannot count, simply records existance of the number.
 namespace redditTest
 {
-    struct test_type : Test
+    template <Container container_type>
+    struct test_type final : Test
     {
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
+        {
+            return *static_cast<container_type *>(ti.container);
+        }
     private:
         static void reportReddit(ThreadInfo &ti)
         {
-            size_t elemCount = ((container_type *)ti.container)->count();
+            size_t elemCount = container(ti).count();
             for (size_t i = 0; i < elemCount; i++)
             {
-                if (((container_type *)ti.container)->contains(i))
+                if (container(ti).contains(i))
                 {
-                    std::cout << "Node  " << i << ":\t" << ((container_type *)ti.container)->get(i) << std::endl;
+                    std::cout << "Node  " << i << ":\t" << container(ti).get(i) << std::endl;
                 }
             }
         }
@@ -37,11 +43,12 @@ namespace redditTest
             }
             std::string line;
             uintptr_t val;
-            while (std::getline(reddit, line))
+            while (!stopped(ti) && std::getline(reddit, line))
             {
                 std::stringstream ss(line);
                 ss >> val;
-                ((container_type *)ti.container)->increment(val);
+                container(ti).increment(val);
+                op_done(ti);
             }
         }
 
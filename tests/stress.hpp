@@ -0,0 +1,134 @@
+#ifndef STRESS_HPP
+#define STRESS_HPP
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "prng.hpp"
+#include "test.hpp"
+
+// A correctness stress test.
+// Every thread owns a disjoint set of keys and knows what each of them must hold.
+// Threads mix inserts, removals, replacements and lookups on their own keys, from a small table,
+// so every operation races with resizes, migration and, by default, the release of migrated chunks.
+// Every result is checked as it comes back, and every key once more after the run. Any mismatch fails the test.
+namespace stressTest
+{
+    template <Container container_type>
+    struct test_type final : Test
+    {
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
+        {
+            return *static_cast<container_type *>(ti.container);
+        }
+        // The value each key of each thread must hold, or 0 if it must be absent.
+        std::vector<std::vector<ValT>> expected;
+        // Mismatches each thread found during the run.
+        std::vector<size_t> mismatches;
+        uint64_t seed = 1;
+
+        void configure(const TestOptions &opt)
+        {
+            seed = opt.randomSeed;
+        }
+        // Key number slot of a thread.
+        static KeyT key(size_t thread, size_t threads, size_t slot)
+        {
+            return 1 + thread + threads * slot;
+        }
+        // Each thread works on about a quarter as many keys as it runs operations, so keys come and go many times.
+        void container_test_prefix(ThreadInfo &ti)
+        {
+            size_t keys = std::max(ti.pnoiter / ti.num_threads / 4, (size_t)1);
+            expected.assign(ti.num_threads, std::vector<ValT>(keys, 0));
+            mismatches.assign(ti.num_threads, 0);
+            return;
+        }
+        void container_test(ThreadInfo &ti)
+        {
+            const size_t numops = opsPerThread(ti.num_threads, ti.pnoiter, ti.num);
+            std::vector<ValT> &values = expected[ti.num];
+            Xoshiro256 rng(seed * 0x9e3779b97f4a7c15 + ti.num);
+
+            for (size_t i = 0; keep_going(ti, i, numops); i++)
+            {
+                size_t slot = rng.below(values.size());
+                KeyT k = key(ti.num, ti.num_threads, slot);
+                ValT &value = values[slot];
+                bool ok = true;
+                switch (rng.below(4))
+                {
+                case 0:
+                {
+                    LatencyTimer timer(ti.latency, OpType::INSERT);
+                    container(ti).insert(k);
+                    value = k;
+                    break;
+                }
+                case 1:
+                {
+                    LatencyTimer timer(ti.latency, OpType::ERASE);
+                    container(ti).erase(k);
+                    value = 0;
+                    break;
+                }
+                case 2:
+                {
+                    LatencyTimer timer(ti.latency, OpType::UPDATE);
+                    // Small enough for every container to store.
+                    ValT newValue = 1 + rng.below((uint64_t)1 << 40);
+                    ok = container(ti).update(k, newValue) == (value != 0);
+                    if (value != 0)
+                    {
+                        value = newValue;
+                    }
+                    break;
+                }
+                default:
+                {
+                    LatencyTimer timer(ti.latency, OpType::GET);
+                    ok = value != 0 ? container(ti).get(k) == value : !container(ti).contains(k);
+                    break;
+                }
+                }
+                if (!ok)
+                {
+                    ++ti.fail;
+                    mismatches[ti.num]++;
+                }
+                op_done(ti);
+            }
+        }
+        // Check every key, then fail the test if anything was wrong.
+        void container_test_suffix(ThreadInfo &ti)
+        {
+            size_t during = 0;
+            size_t after = 0;
+            for (size_t thread = 0; thread < expected.size(); thread++)
+            {
+                during += mismatches[thread];
+                for (size_t slot = 0; slot < expected[thread].size(); slot++)
+                {
+                    KeyT k = key(thread, expected.size(), slot);
+                    ValT value = expected[thread][slot];
+                    if (value != 0 ? container(ti).get(k) != value : container(ti).contains(k))
+                    {
+                        after++;
+                    }
+                }
+            }
+            if (during > 0 || after > 0)
+            {
+                throw std::runtime_error("stress test: " + std::to_string(during) + " wrong results during the run, " +
+                                         std::to_string(after) + " wrong keys after it");
+            }
+            std::cout << "stress test: every result and key checked out" << std::endl;
+            return;
+        }
+    };
+} // namespace stressTest
+
+#endif
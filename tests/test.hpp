@@ -4,6 +4,8 @@
 
 #include <signal.h>
 
+#include "container.hpp"
+#include "numa.hpp"
 #include "runTest.hpp"
 
 class Test
@@ -21,9 +23,19 @@ public:
         }
     }
 
+    // Runs once, before any test run, with the options given on the command line.
+    virtual void configure(__attribute__((unused)) const TestOptions &opt)
+    {
+    }
     // Runs on the main thread at the beginning of a test.
-    // Commonly used to pre-fill or initialize the test in some way.
+    // Commonly used to initialize the test in some way.
     virtual void container_test_prefix(ThreadInfo &ti) = 0;
+    // Runs on every thread after the prefix, before the test, to pre-fill the container.
+    // Each thread does its own share, by ti.num of ti.num_threads, and counts its operations with op_done.
+    // It is timed on its own, so it doubles as a benchmark of concurrent inserts into a growing table.
+    virtual void container_test_prefill(__attribute__((unused)) ThreadInfo &ti)
+    {
+    }
     // The actual test, typically run in parallel.
     virtual void container_test(ThreadInfo &ti) = 0;
     // Runs on the main thread at the end of a test.
@@ -31,12 +43,55 @@ public:
     virtual void container_test_suffix(ThreadInfo &ti) = 0;
     // The function run by each thread.
     // Typically includes container_test, but can have more if needed.
-    static void ptest(Test *test, ThreadInfo &ti, time_point &starttime)
+    // The clock is started by the main thread, once every thread has reached sync_start.
+    static void ptest(Test *test, ThreadInfo &ti)
     {
-        localThreadNum = ti.num;
+        setup_thread(ti);
+        // Counters are opened ahead of time, so only the test itself is counted.
+        if (ti.perf != nullptr)
+        {
+            ti.perf->open();
+        }
         test->sync_start();
-        starttime = std::chrono::system_clock::now();
+        if (ti.perf != nullptr)
+        {
+            ti.perf->start();
+        }
         test->container_test(ti);
+        if (ti.perf != nullptr)
+        {
+            ti.perf->stop();
+        }
+        finish_thread(ti);
+    }
+    // The function run by each thread of the prefill.
+    static void pprefill(Test *test, ThreadInfo &ti)
+    {
+        setup_thread(ti);
+        test->sync_start();
+        test->container_test_prefill(ti);
+        finish_thread(ti);
+    }
+    // Number and pin a test thread.
+    static void setup_thread(const ThreadInfo &ti)
+    {
+        localThreadNum = ti.num;
+        if (ti.cpu >= 0)
+        {
+            int rc = pinThread(ti.cpu);
+            if (rc != 0)
+            {
+                std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+            }
+        }
+    }
+    // Record when a test thread finished.
+    static void finish_thread(ThreadInfo &ti)
+    {
+        if (ti.progress != nullptr)
+        {
+            ti.progress->finished.store(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
     }
     // A test-specific consistency check.
     virtual bool consistency_check(__attribute__((unused)) Test *test,
@@ -45,6 +100,26 @@ public:
         printf("No consistency check defined for this test. Assuming consistent.\n");
         return true;
     }
+    // Whether a test running for a duration has been told to stop.
+    static bool stopped(const ThreadInfo &ti)
+    {
+        return ti.stop != nullptr && ti.stop->load(std::memory_order_relaxed);
+    }
+    // Whether to run operation number i of numops.
+    // In duration mode, tests that can run forever ignore numops and run until stopped.
+    static bool keep_going(const ThreadInfo &ti, size_t i, size_t numops)
+    {
+        return ti.stop != nullptr ? !stopped(ti) : i < numops;
+    }
+    // Count an operation the thread completed.
+    static void op_done(ThreadInfo &ti)
+    {
+        if (ti.progress != nullptr)
+        {
+            // Only the owning thread writes its count.
+            ti.progress->ops.store(ti.progress->ops.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    }
     // The number of operations that a thread will carry out
     static size_t opsPerThread(size_t numThreads, size_t totalOps, size_t threadID)
     {
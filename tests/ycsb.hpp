@@ -1,164 +1,177 @@
 #ifndef YCSB_HPP
 #define YCSB_HPP
 
+#include <filesystem>
+
 #include "test.hpp"
+#include "ycsbGenerator.hpp"
+#include "ycsbTrace.hpp"
 
 // An YCSB test.
-// Preinserts elements, then runs various workload distributions, from file.
+// Preinserts elements, then runs various workload distributions,
+// from a trace converted by tools/ycsbConvert.cpp or generated in process.
 namespace YCSBTest
 {
-    const size_t operationCount = 16000000;
-    struct op
+    template <Container container_type>
+    struct test_type final : Test
     {
-        typedef enum opType
+        // The container a thread works on.
+        static container_type &container(const ThreadInfo &ti)
         {
-            INSERT,
-            READ,
-            DELETE,
-            UPDATE
-        } opType;
-        opType operation;
-        ValT val;
-    };
-
-    op **runQueue;
-    size_t *move;
+            return *static_cast<container_type *>(ti.container);
+        }
+        // The trace to run, and its mapping, shared by every thread.
+        std::string tracePath;
+        YcsbTrace trace;
+        // Or, what to generate, the run phase length, and the generated op streams, one per thread.
+        bool generate = false;
+        YcsbSpec spec;
+        size_t runOps = 0;
+        std::vector<std::vector<uint64_t>> generatedKeys;
+        std::vector<std::vector<YcsbTrace::Op>> generatedOps;
 
-    struct test_type : Test
-    {
-        void container_test_prefix(ThreadInfo &ti)
+        // Pick the trace: the one given, or the converted trace of a workload in the YCSB directory.
+        // When generating, the workload's mix and distribution apply unless they are overridden.
+        void configure(const TestOptions &opt)
         {
-            FILE *ycsb, *ycsb_read;
-            char buf[1024];
-            char *pbuf = buf;
-            size_t len = 1024;
-
-            // Load phase.
-            // TODO: Figure out a better way to pass in file name.
-            if ((ycsb = fopen("/home/kenneth/PMap/data/YCSB/outputLoada.txt", "r")) == nullptr)
+            if (opt.ycsbWorkload.size() != 1 || opt.ycsbWorkload[0] < 'a' || opt.ycsbWorkload[0] > 'f')
             {
-                printf("failed to read %s\n", "/home/kenneth/PMap/data/YCSB/outputLoada.txt");
-                exit(1);
+                throw std::runtime_error("YCSB workloads are a to f, not " + opt.ycsbWorkload);
             }
-            while (getline(&pbuf, &len, ycsb) != -1)
+            tracePath = !opt.ycsbTrace.empty() ? opt.ycsbTrace : (std::filesystem::path(opt.ycsbDir) / ("workload" + opt.ycsbWorkload + ".trace")).string();
+            generate = opt.ycsbGenerate;
+            if (generate)
             {
-                if (strncmp(buf, "INSERT", 6) == 0)
+                spec = YcsbSpec::workload(opt.ycsbWorkload[0]);
+                spec.records = opt.ycsbRecords;
+                if (!opt.ycsbMix.empty())
+                {
+                    spec.parseMix(opt.ycsbMix);
+                }
+                if (!opt.ycsbDistribution.empty())
                 {
-                    size_t scanVal;
-                    sscanf(buf + 7, "%zu", &scanVal);
-                    ValT val = (ValT)scanVal;
-                    int succ = ((container_type *)ti.container)->insert(val);
-                    assert(succ >= 0);
-                    ++ti.succ;
+                    spec.parseDistribution(opt.ycsbDistribution);
                 }
+                spec.theta = opt.ycsbTheta;
+                spec.seed = opt.ycsbSeed;
+                runOps = opt.numops;
             }
-            fclose(ycsb);
-
-            // Now prepare data for the run phase.
-
-            // Create a run queue to fill in.
-            runQueue = new op *[ti.num_threads];
-            for (size_t i = 0; i < ti.num_threads; ++i)
+        }
+        // Map the trace, or generate the op streams, once for every run.
+        void container_test_prefix(ThreadInfo &ti)
+        {
+            if (generate)
             {
-                runQueue[i] = new op[operationCount];
+                if (generatedKeys.size() != ti.num_threads)
+                {
+                    generateStreams(ti.num_threads);
+                }
             }
-
-            // TODO: Figure out a better way to pass in file name.
-            if ((ycsb_read = fopen("/home/kenneth/PMap/data/YCSB/outputRuna.txt", "r")) == NULL)
+            else if (trace.mappedPath() != tracePath)
             {
-                printf("fail to read %s\n", "/home/kenneth/PMap/data/YCSB/outputRuna.txt");
-                exit(1);
+                trace.open(tracePath);
             }
-
-            move = new size_t[ti.num_threads];
-            for (size_t t = 0; t < ti.num_threads; t++)
+            return;
+        }
+        // Generate every thread's op stream, in parallel.
+        void generateStreams(size_t threads)
+        {
+            time_point start = std::chrono::steady_clock::now();
+            generatedKeys.assign(threads, {});
+            generatedOps.assign(threads, {});
+            const ZipfianGenerator zipfian(spec.records, spec.theta);
+            std::vector<std::thread> generators;
+            for (size_t t = 0; t < threads; t++)
             {
-                move[t] = 0;
+                generators.emplace_back([this, &zipfian, t, threads]()
+                                        { YcsbGenerator(spec, zipfian, t, threads).generate(opsPerThread(threads, runOps, t), generatedKeys[t], generatedOps[t]); });
             }
-
-            size_t operation_num = 0;
-            size_t scanVal;
-            while (getline(&pbuf, &len, ycsb_read) != -1)
+            for (std::thread &generator : generators)
             {
-                if (strncmp(buf, "INSERT", 6) == 0)
-                {
-                    sscanf(buf + 7, "%zu", &scanVal);
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].val = scanVal;
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].operation = op::opType::INSERT;
-                    move[operation_num % ti.num_threads]++;
-                }
-                else if (strncmp(buf, "READ", 4) == 0)
-                {
-                    sscanf(buf + 5, "%zu", &scanVal);
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].val = scanVal;
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].operation = op::opType::READ;
-                    move[operation_num % ti.num_threads]++;
-                }
-                else if (strncmp(buf, "DELETE", 6) == 0)
-                {
-                    sscanf(buf + 7, "%zu", &scanVal);
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].val = scanVal;
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].operation = op::opType::DELETE;
-                    move[operation_num % ti.num_threads]++;
-                }
-                else if (strncmp(buf, "UPDATE", 6) == 0)
-                {
-                    sscanf(buf + 7, "%zu", &scanVal);
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].val = scanVal;
-                    runQueue[operation_num % ti.num_threads][move[operation_num % ti.num_threads]].operation = op::opType::UPDATE;
-                    move[operation_num % ti.num_threads]++;
-                }
-                assert(move[operation_num % ti.num_threads] <= operationCount);
-                operation_num++;
-                // Can stop early if we want to test a subset of operations.
-                if (operation_num > operationCount)
-                {
-                    break;
-                }
+                generator.join();
             }
-            fclose(ycsb_read);
-
-            return;
+            std::cout << "YCSB generated: " << spec.describe() << ", " << runOps << " ops in "
+                      << std::chrono::duration_cast<duration_unit>(std::chrono::steady_clock::now() - start).count() << "ms" << std::endl;
         }
+        // Each thread inserts its slice of the load phase.
+        void container_test_prefill(ThreadInfo &ti)
+        {
+            const size_t records = generate ? spec.records : trace.loadCount();
+            const size_t first = records * ti.num / ti.num_threads;
+            const size_t last = records * (ti.num + 1) / ti.num_threads;
+            for (size_t i = first; i < last; i++)
+            {
+                container(ti).insert(generate ? YcsbGenerator::key(i) : trace.loadKeys()[i]);
+                ++ti.succ;
+                op_done(ti);
+            }
+        }
+        // Each thread runs its own op stream, or its slice of the trace straight from the mapping.
         void container_test(ThreadInfo &ti)
         {
-            const size_t tinum = ti.num;
-            const size_t maxops = opsPerThread(ti.num_threads, ti.pnoiter, 0);
-            const size_t numops = opsPerThread(ti.num_threads, ti.pnoiter, tinum);
-            size_t nummain = opsMainLoop(numops);
-            size_t wrid = numops - nummain;
-            size_t rdid = wrid / 2;
+            const uint64_t *keys;
+            const YcsbTrace::Op *ops;
+            size_t count;
+            if (generate)
+            {
+                keys = generatedKeys[ti.num].data();
+                ops = generatedOps[ti.num].data();
+                count = generatedKeys[ti.num].size();
+            }
+            else
+            {
+                const size_t first = trace.runCount() * ti.num / ti.num_threads;
+                count = trace.runCount() * (ti.num + 1) / ti.num_threads - first;
+                keys = trace.runKeys() + first;
+                ops = trace.runOps() + first;
+            }
 
-            for (size_t i = 0; i < move[tinum]; i++)
+            // The timed operation type of each YCSB operation.
+            static const OpType TYPES[] = {OpType::INSERT, OpType::GET, OpType::ERASE, OpType::UPDATE, OpType::READ_MODIFY_WRITE};
+            if (count == 0)
+            {
+                return;
+            }
+            // In duration mode, the thread's share of the trace is replayed until the test is stopped.
+            for (size_t n = 0; keep_going(ti, n, count); n++)
             {
-                if (runQueue[tinum][i].operation == op::opType::INSERT)
+                size_t i = n % count;
+                // Every write stores a new value, so updates are never no-ops.
+                const ValT value = (ValT)(n + 1);
+                LatencyTimer timer(ti.latency, TYPES[ops[i]]);
+                if (ops[i] == YcsbTrace::INSERT)
+                {
+                    container(ti).insert(keys[i]);
+                }
+                else if (ops[i] == YcsbTrace::READ)
                 {
-                    ((container_type *)ti.container)->insert(runQueue[tinum][i].val);
+                    container(ti).get((KeyT)(keys[i]));
                 }
-                else if (runQueue[tinum][i].operation == op::opType::READ)
+                else if (ops[i] == YcsbTrace::DELETE)
                 {
-                    ((container_type *)ti.container)->contains((KeyT)(runQueue[tinum][i].val));
+                    container(ti).erase(keys[i]);
                 }
-                else if (runQueue[tinum][i].operation == op::opType::DELETE)
+                else if (ops[i] == YcsbTrace::UPDATE)
                 {
-                    ((container_type *)ti.container)->erase(runQueue[tinum][i].val);
+                    container(ti).update((KeyT)(keys[i]), value);
                 }
-                else if (runQueue[tinum][i].operation == op::opType::UPDATE)
+                else if (ops[i] == YcsbTrace::READ_MODIFY_WRITE)
                 {
-                    ((container_type *)ti.container)->insert(runQueue[tinum][i].val);
+                    container(ti).readModifyWrite((KeyT)(keys[i]), value);
                 }
                 else
                 {
                     printf("unknown clevel_op\n");
                     exit(1);
                 }
+                op_done(ti);
             }
         }
-        void container_test_suffix(ThreadInfo &ti)
+        void container_test_suffix(__attribute__((unused)) ThreadInfo &ti)
         {
             return;
         }
     };
 } // namespace YCSBTest
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,301 @@
+// A native generator for the YCSB core workloads, so no Java YCSB install is needed.
+// It follows YCSB's CoreWorkload: hashed keys, a read/update/insert/read-modify-write mix,
+// and uniform, zipfian, latest or hotspot request distributions.
+// Each thread generates its own op stream from the seed and its thread number, so runs are reproducible.
+#ifndef YCSB_GENERATOR_HPP
+#define YCSB_GENERATOR_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "prng.hpp"
+#include "ycsbTrace.hpp"
+
+enum class YcsbDistribution
+{
+    UNIFORM,
+    ZIPFIAN,
+    LATEST,
+    HOTSPOT
+};
+
+// What to generate.
+struct YcsbSpec
+{
+    // Records inserted by the load phase.
+    size_t records = 64000;
+    // Proportions of the run phase mix. They need not add up to one.
+    double read = 1;
+    double update = 0;
+    double insert = 0;
+    double readModifyWrite = 0;
+    YcsbDistribution distribution = YcsbDistribution::ZIPFIAN;
+    // Skew of the zipfian and latest distributions. YCSB uses 0.99.
+    double theta = 0.99;
+    // For hotspot: the fraction of records that are hot, and the fraction of operations that go to them.
+    double hotData = 0.2;
+    double hotOps = 0.8;
+    uint64_t seed = 1;
+
+    // The mix and distribution of a YCSB core workload. Workload E needs range scans, which the containers do not have.
+    static YcsbSpec workload(char name)
+    {
+        YcsbSpec spec;
+        switch (name)
+        {
+        case 'a':
+            spec.read = 0.5;
+            spec.update = 0.5;
+            break;
+        case 'b':
+            spec.read = 0.95;
+            spec.update = 0.05;
+            break;
+        case 'c':
+            break;
+        case 'd':
+            spec.read = 0.95;
+            spec.insert = 0.05;
+            spec.distribution = YcsbDistribution::LATEST;
+            break;
+        case 'f':
+            spec.read = 0.5;
+            spec.readModifyWrite = 0.5;
+            break;
+        default:
+            throw std::runtime_error(std::string("cannot generate YCSB workload ") + name + ": only a, b, c, d and f are supported");
+        }
+        return spec;
+    }
+    // Set the mix from "read,update,insert,rmw" proportions, such as "50,50,0,0".
+    void parseMix(const std::string &mix)
+    {
+        std::stringstream stream(mix);
+        std::string field;
+        std::vector<double> parts;
+        while (std::getline(stream, field, ','))
+        {
+            char *end;
+            parts.push_back(strtod(field.c_str(), &end));
+            if (end == field.c_str() || parts.back() < 0)
+            {
+                parts.clear();
+                break;
+            }
+        }
+        if (parts.size() != 4 || parts[0] + parts[1] + parts[2] + parts[3] <= 0)
+        {
+            throw std::runtime_error("a YCSB mix is four proportions, read,update,insert,rmw: " + mix);
+        }
+        read = parts[0];
+        update = parts[1];
+        insert = parts[2];
+        readModifyWrite = parts[3];
+    }
+    void parseDistribution(const std::string &name)
+    {
+        if (name == "uniform")
+        {
+            distribution = YcsbDistribution::UNIFORM;
+        }
+        else if (name == "zipfian")
+        {
+            distribution = YcsbDistribution::ZIPFIAN;
+        }
+        else if (name == "latest")
+        {
+            distribution = YcsbDistribution::LATEST;
+        }
+        else if (name == "hotspot")
+        {
+            distribution = YcsbDistribution::HOTSPOT;
+        }
+        else
+        {
+            throw std::runtime_error("unknown YCSB distribution: " + name);
+        }
+    }
+    std::string describe() const
+    {
+        static const char *const NAMES[] = {"uniform", "zipfian", "latest", "hotspot"};
+        std::stringstream stream;
+        stream << records << " records, mix read/update/insert/rmw = " << read << "/" << update << "/" << insert << "/" << readModifyWrite
+               << ", " << NAMES[(size_t)distribution];
+        if (distribution == YcsbDistribution::ZIPFIAN || distribution == YcsbDistribution::LATEST)
+        {
+            stream << " (theta " << theta << ")";
+        }
+        else if (distribution == YcsbDistribution::HOTSPOT)
+        {
+            stream << " (" << hotOps << " of ops on " << hotData << " of records)";
+        }
+        stream << ", seed " << seed;
+        return stream.str();
+    }
+};
+
+// Zipfian ranks in [0, items), rank 0 the most popular, by the method of Gray et al. that YCSB uses.
+// The item count can grow, as it does for the latest distribution; the zeta constant is then extended incrementally.
+class ZipfianGenerator
+{
+public:
+    ZipfianGenerator(size_t items, double theta) : theta(theta), alpha(1 / (1 - theta)), zeta2(zeta(0, 2, theta, 0))
+    {
+        if (!(theta > 0 && theta < 1) || items == 0)
+        {
+            throw std::runtime_error("zipfian theta must be in (0, 1), with at least one item");
+        }
+        resize(items);
+    }
+    size_t next(Xoshiro256 &rng)
+    {
+        double u = rng.uniform();
+        double uz = u * zetan;
+        if (uz < 1)
+        {
+            return 0;
+        }
+        if (uz < 1 + std::pow(0.5, theta))
+        {
+            return 1;
+        }
+        size_t rank = (size_t)(items * std::pow(eta * u - eta + 1, alpha));
+        return rank < items ? rank : items - 1;
+    }
+    // Grow the item count.
+    void resize(size_t newItems)
+    {
+        if (newItems > items)
+        {
+            zetan = zeta(items, newItems, theta, zetan);
+            items = newItems;
+            eta = (1 - std::pow(2.0 / items, 1 - theta)) / (1 - zeta2 / zetan);
+        }
+    }
+    size_t itemCount() const
+    {
+        return items;
+    }
+
+private:
+    // Extend a zeta sum over items [first, last).
+    static double zeta(size_t first, size_t last, double theta, double sum)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            sum += 1 / std::pow((double)(i + 1), theta);
+        }
+        return sum;
+    }
+
+    double theta;
+    double alpha;
+    double zeta2;
+    size_t items = 0;
+    double zetan = 0;
+    double eta = 0;
+};
+
+// The op stream of one thread.
+class YcsbGenerator
+{
+public:
+    // The key of record number n. Hashed, like YCSB's keys, so that popular records are not neighbours.
+    // Kept to 56 bits, clear of the values containers reserve.
+    static uint64_t key(uint64_t n)
+    {
+        uint64_t hash = 0xcbf29ce484222325;
+        for (size_t byte = 0; byte < 8; byte++)
+        {
+            hash = (hash ^ ((n >> (8 * byte)) & 0xff)) * 0x100000001b3;
+        }
+        return hash >> 8;
+    }
+
+    // Thread number thread of threads. The zipfian generator is copied, so its zeta constant is only computed once.
+    YcsbGenerator(const YcsbSpec &spec, const ZipfianGenerator &zipfian, size_t thread, size_t threads)
+        : spec(spec), zipfian(zipfian), rng(spec.seed * 0x9e3779b97f4a7c15 + thread), thread(thread), threads(threads)
+    {
+        double total = spec.read + spec.update + spec.insert + spec.readModifyWrite;
+        readBelow = spec.read / total;
+        updateBelow = readBelow + spec.update / total;
+        insertBelow = updateBelow + spec.insert / total;
+    }
+
+    // Generate count operations.
+    void generate(size_t count, std::vector<uint64_t> &keys, std::vector<YcsbTrace::Op> &ops)
+    {
+        keys.reserve(keys.size() + count);
+        ops.reserve(ops.size() + count);
+        for (size_t i = 0; i < count; i++)
+        {
+            double choice = rng.uniform();
+            if (choice >= updateBelow && choice < insertBelow)
+            {
+                // Threads insert new records in turn, so record numbers never collide.
+                keys.push_back(key(spec.records + thread + threads * inserted++));
+                ops.push_back(YcsbTrace::INSERT);
+                continue;
+            }
+            keys.push_back(key(nextRecord()));
+            ops.push_back(choice < readBelow ? YcsbTrace::READ : choice < updateBelow ? YcsbTrace::UPDATE : YcsbTrace::READ_MODIFY_WRITE);
+        }
+    }
+
+private:
+    // A record to read or update, as the request distribution picks it.
+    uint64_t nextRecord()
+    {
+        switch (spec.distribution)
+        {
+        case YcsbDistribution::UNIFORM:
+            return rng.below(spec.records);
+        case YcsbDistribution::HOTSPOT:
+        {
+            uint64_t hot = std::max((uint64_t)1, (uint64_t)(spec.records * spec.hotData));
+            if (rng.uniform() < spec.hotOps || hot >= spec.records)
+            {
+                return rng.below(hot);
+            }
+            return hot + rng.below(spec.records - hot);
+        }
+        case YcsbDistribution::LATEST:
+        {
+            // The most recently inserted records are the most popular.
+            // Only records this thread knows exist are picked: its own inserts, newest first, then the load phase.
+            // Other threads' inserts are never read, as they may not have happened yet.
+            zipfian.resize(spec.records + inserted);
+            uint64_t rank = zipfian.next(rng);
+            if (rank < inserted)
+            {
+                return spec.records + thread + threads * (inserted - 1 - rank);
+            }
+            return spec.records - 1 - (rank - inserted);
+        }
+        default:
+            // Scrambled, as YCSB does, so the popular records are spread over the key space.
+            return key(zipfian.next(rng)) % spec.records;
+        }
+    }
+
+    YcsbSpec spec;
+    ZipfianGenerator zipfian;
+    Xoshiro256 rng;
+    size_t thread;
+    size_t threads;
+    // Records this thread inserted so far.
+    size_t inserted = 0;
+    // Thresholds on a uniform number in [0, 1) that pick the operation.
+    double readBelow;
+    double updateBelow;
+    double insertBelow;
+};
+
+#endif
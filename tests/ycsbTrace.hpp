@@ -0,0 +1,203 @@
+// A compact binary form of a YCSB workload, memory-mapped by the YCSB test.
+// Converted once from the text output of YCSBgenerate.sh by tools/ycsbConvert.cpp, so runs do not parse text.
+// Layout: the header, the load phase keys, the run phase keys, then one op type byte per run phase op.
+// That is 9 bytes per run op, and the keys stay 8 byte aligned.
+#ifndef YCSB_TRACE_HPP
+#define YCSB_TRACE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class YcsbTrace
+{
+public:
+    // Run phase operations. The values are stored in the trace, so they must not change.
+    enum Op : uint8_t
+    {
+        INSERT = 0,
+        READ = 1,
+        DELETE = 2,
+        UPDATE = 3,
+        // Read a record, then write it back. Only generated, as YCSB's text output splits it into a read and an update.
+        READ_MODIFY_WRITE = 4
+    };
+    static constexpr uint64_t MAGIC = 0x3143525442534359; // "YCSBTRC1"
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t loadCount;
+        uint64_t runCount;
+    };
+
+    YcsbTrace() = default;
+    ~YcsbTrace()
+    {
+        close();
+    }
+    YcsbTrace(const YcsbTrace &) = delete;
+    YcsbTrace &operator=(const YcsbTrace &) = delete;
+
+    // Map a trace read-only. Any trace mapped before is unmapped.
+    void open(const std::string &path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            throw std::runtime_error("cannot open YCSB trace " + path + ": " + strerror(errno));
+        }
+        struct stat finfo;
+        if (fstat(fd, &finfo) != 0 || (size_t)finfo.st_size < sizeof(Header))
+        {
+            ::close(fd);
+            throw std::runtime_error("not a YCSB trace: " + path);
+        }
+        length = finfo.st_size;
+        void *address = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+        {
+            throw std::runtime_error("cannot map YCSB trace " + path + ": " + strerror(errno));
+        }
+        header = (const Header *)address;
+        if (header->magic != MAGIC || bytes(header->loadCount, header->runCount) != length)
+        {
+            close();
+            throw std::runtime_error("not a YCSB trace, or truncated: " + path);
+        }
+        this->path = path;
+        // Read it in now, rather than faulting during the timed run.
+        madvise(address, length, MADV_WILLNEED);
+    }
+    void close()
+    {
+        if (header != nullptr)
+        {
+            munmap((void *)header, length);
+            header = nullptr;
+            path.clear();
+        }
+    }
+    const std::string &mappedPath() const
+    {
+        return path;
+    }
+
+    size_t loadCount() const
+    {
+        return header->loadCount;
+    }
+    size_t runCount() const
+    {
+        return header->runCount;
+    }
+    const uint64_t *loadKeys() const
+    {
+        return (const uint64_t *)(header + 1);
+    }
+    const uint64_t *runKeys() const
+    {
+        return loadKeys() + header->loadCount;
+    }
+    const Op *runOps() const
+    {
+        return (const Op *)(runKeys() + header->runCount);
+    }
+
+    // The size of a trace.
+    static size_t bytes(size_t loadCount, size_t runCount)
+    {
+        return sizeof(Header) + (loadCount + runCount) * sizeof(uint64_t) + runCount * sizeof(Op);
+    }
+
+    // Read a text trace, as left by YCSBgenerate.sh: one "OP key" per line.
+    // Load phase files only contribute their inserts. Operations the test cannot run, such as scans, are counted in skipped.
+    static void parseText(const std::string &path, bool load, std::vector<uint64_t> &keys, std::vector<Op> &ops, size_t &skipped)
+    {
+        FILE *file = fopen(path.c_str(), "r");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("cannot read " + path + ": " + strerror(errno));
+        }
+        char op[32];
+        unsigned long long key;
+        char line[1024];
+        while (fgets(line, sizeof(line), file) != nullptr)
+        {
+            if (sscanf(line, "%31s %llu", op, &key) != 2)
+            {
+                skipped++;
+                continue;
+            }
+            Op type;
+            if (strcmp(op, "INSERT") == 0)
+            {
+                type = INSERT;
+            }
+            else if (!load && strcmp(op, "READ") == 0)
+            {
+                type = READ;
+            }
+            else if (!load && strcmp(op, "DELETE") == 0)
+            {
+                type = DELETE;
+            }
+            else if (!load && strcmp(op, "UPDATE") == 0)
+            {
+                type = UPDATE;
+            }
+            else
+            {
+                skipped++;
+                continue;
+            }
+            keys.push_back(key);
+            if (!load)
+            {
+                ops.push_back(type);
+            }
+        }
+        fclose(file);
+    }
+
+    // Write a trace.
+    static void write(const std::string &path, const std::vector<uint64_t> &loadKeys, const std::vector<uint64_t> &runKeys, const std::vector<Op> &runOps)
+    {
+        if (runKeys.size() != runOps.size())
+        {
+            throw std::logic_error("every run op needs a key");
+        }
+        FILE *file = fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("cannot create " + path + ": " + strerror(errno));
+        }
+        Header h = {MAGIC, loadKeys.size(), runKeys.size()};
+        bool written = fwrite(&h, sizeof(h), 1, file) == 1 &&
+                       fwrite(loadKeys.data(), sizeof(uint64_t), loadKeys.size(), file) == loadKeys.size() &&
+                       fwrite(runKeys.data(), sizeof(uint64_t), runKeys.size(), file) == runKeys.size() &&
+                       fwrite(runOps.data(), sizeof(Op), runOps.size(), file) == runOps.size();
+        if (fclose(file) != 0 || !written)
+        {
+            throw std::runtime_error("cannot write " + path);
+        }
+    }
+
+private:
+    const Header *header = nullptr;
+    size_t length = 0;
+    std::string path;
+};
+
+#endif
@@ -0,0 +1,91 @@
+// Offline compaction of a persistent map.
+// Recovers the chain of tables in a directory or pool, the same way the map does on startup,
+// and rewrites the live pairs into a single table sized for them at the target load factor.
+// The map must not be in use by any other process.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cliffMap/hashMap.hpp"
+
+using Map = ConcurrentHashMap<KeyT, ValT>;
+
+static void help(const std::string &name)
+{
+    MapOptions defaults;
+    std::cout << "usage: " << name << " [options]\n"
+              << "Rewrites a map's chain of tables into one right-sized table.\n"
+              << "-f name           directory holding the table files (default: /mnt/pmem/pm1/tables/)\n"
+              << "--pool name       pool file or device-DAX region holding the tables, instead of a directory\n"
+              << "--load-factor num target fraction of the new table's slots holding pairs (default: " << defaults.loadFactor << ")\n"
+              << "-t num            number of threads (default: all " << std::max(std::thread::hardware_concurrency(), 1u) << " cores)\n"
+              << "-h                displays this help message\n"
+              << std::endl;
+    exit(0);
+}
+
+int main(int argc, char **args)
+{
+    std::vector<std::string> arguments(args, args + argc);
+    std::string fileDir = "/mnt/pmem/pm1/tables/";
+    // Compact on every core by default.
+    size_t threads = std::max(std::thread::hardware_concurrency(), 1u);
+    MapOptions options;
+    // Migrations left by a crash are finished by the compaction itself.
+    options.recoveryMigrators = 0;
+
+    for (size_t argn = 1; argn < arguments.size(); argn++)
+    {
+        const std::string &arg = arguments.at(argn);
+        bool hasValue = argn + 1 < arguments.size();
+        if (arg == "-f" && hasValue)
+        {
+            fileDir = arguments.at(++argn);
+        }
+        else if (arg == "--pool" && hasValue)
+        {
+            options.poolPath = arguments.at(++argn);
+        }
+        else if (arg == "--load-factor" && hasValue)
+        {
+            options.loadFactor = std::stod(arguments.at(++argn));
+        }
+        else if (arg == "-t" && hasValue)
+        {
+            threads = std::stoul(arguments.at(++argn));
+        }
+        else if (arg == "-h")
+        {
+            help(arguments.at(0));
+        }
+        else
+        {
+            std::cerr << "unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        auto start = std::chrono::steady_clock::now();
+        Map *map = new Map(fileDir.c_str(), Map::Table::MIN_SIZE, true, options);
+        auto recovered = std::chrono::steady_clock::now();
+        size_t live = map->compact(threads);
+        auto compacted = std::chrono::steady_clock::now();
+        delete map;
+
+        std::cout << "recovered in " << std::chrono::duration_cast<std::chrono::milliseconds>(recovered - start).count() << "ms" << std::endl
+                  << "compacted " << live << " pairs in " << std::chrono::duration_cast<std::chrono::milliseconds>(compacted - recovered).count() << "ms" << std::endl;
+    }
+    catch (const std::runtime_error &err)
+    {
+        std::cerr << "compaction failed: " << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
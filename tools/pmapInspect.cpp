@@ -0,0 +1,183 @@
+// Offline inspection of a persistent map.
+// Maps every table in a directory or pool read-only and reports how its slots are used:
+// occupancy, tombstones, migration progress, displacement from home slots, clusters and probe lengths.
+// Nothing is recovered or written, so the map's files are left exactly as they were found.
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cliffMap/hashMap.hpp"
+
+using Map = ConcurrentHashMap<KeyT, ValT>;
+
+static void help(const std::string &name)
+{
+    std::cout << "usage: " << name << " [options]\n"
+              << "Reports the layout of each table of a map, without modifying it.\n"
+              << "-f name           directory holding the table files (default: /mnt/pmem/pm1/tables/)\n"
+              << "--pool name       pool file or device-DAX region holding the tables, instead of a directory\n"
+              << "-t num            number of threads (default: " << std::thread::hardware_concurrency() << ")\n"
+              << "-h                displays this help message\n"
+              << std::endl;
+    exit(0);
+}
+
+// Map a whole file read-only.
+static void *mapReadOnly(const std::string &path, size_t &length)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw std::runtime_error("cannot open " + path + ": " + strerror(errno));
+    }
+    struct stat finfo;
+    if (fstat(fd, &finfo) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("cannot stat " + path + ": " + strerror(errno));
+    }
+    length = finfo.st_size;
+    if (S_ISCHR(finfo.st_mode))
+    {
+        length = TablePool::devDaxSize(finfo.st_rdev);
+    }
+    void *address = length > 0 ? mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (address == MAP_FAILED)
+    {
+        throw std::runtime_error("cannot map " + path);
+    }
+    return address;
+}
+
+// Check that a mapping holds a whole, formatted table before it is read.
+static const Map::TableHeader *asTable(const void *address, size_t length)
+{
+    const Map::TableHeader *header = (const Map::TableHeader *)address;
+    if (length < sizeof(Map::TableHeader) || header->magic != TABLE_MAGIC)
+    {
+        return nullptr;
+    }
+    size_t bytes = Map::TableHeader::bytes(header->chunkCount) + (header->capacity + header->stashSize) * sizeof(Map::KVpair);
+    return bytes <= length ? header : nullptr;
+}
+
+int main(int argc, char **args)
+{
+    std::vector<std::string> arguments(args, args + argc);
+    std::string fileDir = "/mnt/pmem/pm1/tables/";
+    std::string poolPath;
+    size_t threads = std::thread::hardware_concurrency();
+
+    for (size_t argn = 1; argn < arguments.size(); argn++)
+    {
+        const std::string &arg = arguments.at(argn);
+        bool hasValue = argn + 1 < arguments.size();
+        if (arg == "-f" && hasValue)
+        {
+            fileDir = arguments.at(++argn);
+        }
+        else if (arg == "--pool" && hasValue)
+        {
+            poolPath = arguments.at(++argn);
+        }
+        else if (arg == "-t" && hasValue)
+        {
+            threads = std::stoul(arguments.at(++argn));
+        }
+        else if (arg == "-h")
+        {
+            help(arguments.at(0));
+        }
+        else
+        {
+            std::cerr << "unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    try
+    {
+        // Tables to report, as (id, header), and the mappings to undo afterwards.
+        std::vector<std::pair<size_t, const Map::TableHeader *>> tables;
+        std::vector<std::pair<void *, size_t>> mappings;
+
+        if (!poolPath.empty())
+        {
+            size_t length;
+            void *base = mapReadOnly(poolPath, length);
+            mappings.emplace_back(base, length);
+            const TablePool::Header *pool = (const TablePool::Header *)base;
+            if (length < sizeof(TablePool::Header) || pool->magic != TablePool::POOL_MAGIC)
+            {
+                throw std::runtime_error(poolPath + " is not a table pool");
+            }
+            for (size_t i = 0; i < TablePool::MAX_EXTENTS; i++)
+            {
+                const TablePool::Extent &e = pool->extents[i];
+                if (e.state.load() != TablePool::USED)
+                {
+                    continue;
+                }
+                const Map::TableHeader *header = e.offset + e.length <= length ? asTable((char *)base + e.offset, e.length) : nullptr;
+                if (header == nullptr)
+                {
+                    std::cerr << "skipping extent " << i << ": not a complete table" << std::endl;
+                    continue;
+                }
+                tables.emplace_back(e.id, header);
+            }
+        }
+        else
+        {
+            for (auto &p : std::filesystem::directory_iterator(fileDir))
+            {
+                if (!p.is_regular_file())
+                {
+                    continue;
+                }
+                const std::string path = p.path().string();
+                size_t length;
+                void *address = mapReadOnly(path, length);
+                mappings.emplace_back(address, length);
+                const Map::TableHeader *header = asTable(address, length);
+                if (header == nullptr)
+                {
+                    std::cerr << "skipping " << path << ": not a complete table" << std::endl;
+                    continue;
+                }
+                tables.emplace_back(Map::Table::numFromName(path.c_str()), header);
+            }
+        }
+
+        std::sort(tables.begin(), tables.end(),
+                  [](const std::pair<size_t, const Map::TableHeader *> &a, const std::pair<size_t, const Map::TableHeader *> &b)
+                  {
+                      return a.first < b.first;
+                  });
+        for (auto &table : tables)
+        {
+            Map::inspect(table.second, threads).print(std::cout, "table " + std::to_string(table.first));
+        }
+        if (tables.empty())
+        {
+            std::cout << "no tables found" << std::endl;
+        }
+
+        for (auto &mapping : mappings)
+        {
+            munmap(mapping.first, mapping.second);
+        }
+    }
+    catch (const std::exception &err)
+    {
+        std::cerr << "inspection failed: " << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,81 @@
+// Converts the text output of YCSBgenerate.sh into the binary trace the YCSB test maps.
+// Run it once per workload; the test then starts in milliseconds instead of parsing text.
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ycsbTrace.hpp"
+
+static void help(const std::string &name)
+{
+    std::cout << "usage: " << name << " --load file --run file -o file\n"
+              << "Converts a YCSB load and run phase, as text, into one binary trace.\n"
+              << "--load name       load phase text, such as outputLoada.txt\n"
+              << "--run name        run phase text, such as outputRuna.txt\n"
+              << "-o name           trace to write, such as workloada.trace\n"
+              << "-h                displays this help message\n"
+              << std::endl;
+    exit(0);
+}
+
+int main(int argc, char **args)
+{
+    std::vector<std::string> arguments(args, args + argc);
+    std::string loadPath;
+    std::string runPath;
+    std::string outPath;
+
+    for (size_t argn = 1; argn < arguments.size(); argn++)
+    {
+        const std::string &arg = arguments.at(argn);
+        bool hasValue = argn + 1 < arguments.size();
+        if (arg == "--load" && hasValue)
+        {
+            loadPath = arguments.at(++argn);
+        }
+        else if (arg == "--run" && hasValue)
+        {
+            runPath = arguments.at(++argn);
+        }
+        else if (arg == "-o" && hasValue)
+        {
+            outPath = arguments.at(++argn);
+        }
+        else if (arg == "-h")
+        {
+            help(arguments.at(0));
+        }
+        else
+        {
+            std::cerr << "unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (loadPath.empty() || runPath.empty() || outPath.empty())
+    {
+        std::cerr << "--load, --run and -o are required" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        std::vector<uint64_t> loadKeys;
+        std::vector<uint64_t> runKeys;
+        std::vector<YcsbTrace::Op> loadOps;
+        std::vector<YcsbTrace::Op> runOps;
+        size_t skipped = 0;
+        YcsbTrace::parseText(loadPath, true, loadKeys, loadOps, skipped);
+        YcsbTrace::parseText(runPath, false, runKeys, runOps, skipped);
+        YcsbTrace::write(outPath, loadKeys, runKeys, runOps);
+        std::cout << outPath << ": " << loadKeys.size() << " load keys, " << runKeys.size() << " run ops, "
+                  << skipped << " lines skipped, " << YcsbTrace::bytes(loadKeys.size(), runKeys.size()) << " bytes" << std::endl;
+    }
+    catch (const std::exception &err)
+    {
+        std::cerr << "conversion failed: " << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}